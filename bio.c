@@ -13,6 +13,12 @@
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 //
+// The data of regular files is cached a page at a time by the
+// page cache (pagecache.c), so that reading a large file does
+// not push the metadata out of here: it reads file blocks with
+// bpageread(), which caches nothing, and hands blocks it writes
+// to the log with bfill() and bforget().
+//
 // The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
@@ -35,6 +41,12 @@ struct {
   struct buf head;
 } bcache;
 
+// Swap I/O (see swap.c) bypasses the cache, so that a run of
+// pages goes to or comes from the disk in a single request.
+// swapbuf[dev] describes that request; its lock serializes
+// swap I/O to the disk.
+static struct buf swapbuf[NDISK];
+
 void
 binit(void)
 {
@@ -53,6 +65,8 @@ binit(void)
     bcache.head.next->prev = b;
     bcache.head.next = b;
   }
+  for(b = swapbuf; b < swapbuf+NDISK; b++)
+    initsleeplock(&b->lock, "swapbuf");
 }
 
 // Look through buffer cache for block on device dev.
@@ -92,47 +106,101 @@ bget(uint dev, uint blockno)
   panic("bget: no buffers");
 }
 
-/* Write 4096 bytes pg to the eight consecutive
- * starting at blk.
+// Return the cached buf for the block, locked, or 0 if
+// the block is not cached.
+static struct buf*
+bfind(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      release(&bcache.lock);
+      acquiresleep(&b->lock);
+      return b;
+    }
+  }
+  release(&bcache.lock);
+  return 0;
+}
+
+/* Transfer nblk blocks, the first being block first of
+ * pages (BPP blocks to a page), to or from the consecutive
+ * disk blocks starting at blk with a single disk request.
  */
 void
-write_page_to_disk(uint dev, char *pg, uint blk)
+swaprw(uint dev, char **pages, uint first, uint nblk, uint blk, int write)
 {
-  struct buf *bp = 0; // CHECK initialization
-  acquiresleep(&bp->lock); // make the whole function blocking -> avoid data race
-  for(int i = 0; i < 8; i++) {
-    for(int j = 0; j < BSIZE; j++) {
-      bp->data[j] = pg[i*BSIZE + j];
+  struct buf *b, *bp;
+  uint i;
+
+  // A cached copy of a block being written is either a file
+  // block freed by a transaction that has not committed yet,
+  // or a block of a swap file.  Update it, or a commit could
+  // write it back over the page, or a read return stale data.
+  for(i = first; write && i < first + nblk; i++){
+    if((bp = bfind(dev, blk + i - first)) != 0){
+      memmove(bp->data, pages[i/BPP] + (i%BPP)*BSIZE, BSIZE);
+      bp->flags |= B_VALID;
+      brelse(bp);
     }
-    bwrite(bp);
   }
-  brelse(bp);
+
+  if(dev >= NDISK)
+    panic("swaprw");
+  b = &swapbuf[dev];
+  acquiresleep(&b->lock);
+  b->dev = dev;
+  b->blockno = blk;
+  b->pages = pages;
+  b->boff = first;
+  b->nblk = nblk;
+  b->flags = write ? B_DIRTY : 0;
+  iderw(b);
+  releasesleep(&b->lock);
 }
 
-/* Read 4096 bytes from the eight consecutive
- * starting at blk into pg.
+/* Read nblk blocks of a file page into pg, as swaprw() does,
+ * for the page cache.  A block cached here is taken from here
+ * instead: a transaction may have written it and not yet
+ * installed it on the disk.
  */
 void
-read_page_from_disk(uint dev, char *pg, uint blk)
+bpageread(uint dev, char *pg, uint first, uint nblk, uint blk)
 {
-  struct buf *bp;
-  int counter = 0;
-  for(uint i = blk; i < blk + 8; i++) {
-    bp = bread(dev, i);    
-    // if( i == blk ) {
-      // strncpy(pg, (char*)bp->data, BSIZE);
-    for(int j = 0; j < BSIZE; j++) {
-      pg[counter] = bp->data[j];
-      counter += 1;
+  struct buf *b;
+  uint i;
+
+  swaprw(dev, &pg, first, nblk, blk, 0);
+  for(i = first; i < first + nblk; i++){
+    if((b = bfind(dev, blk + i - first)) != 0){
+      if(b->flags & B_VALID)
+        memmove(pg + i*BSIZE, b->data, BSIZE);
+      bforget(b);
     }
-    // }
-    // else {
-    //   strncat(pg, (char*)bp->data, BSIZE);
-    // }
-    brelse(bp);
   }
 }
 
+/* Write 4096 bytes pg to the eight consecutive
+ * blocks starting at blk.
+ */
+void
+write_page_to_disk(uint dev, char *pg, uint blk)
+{
+  swaprw(dev, &pg, 0, BPP, blk, 1);
+}
+
+/* Read 4096 bytes from the eight consecutive
+ * blocks starting at blk into pg.
+ */
+void
+read_page_from_disk(uint dev, char *pg, uint blk)
+{
+  swaprw(dev, &pg, 0, BPP, blk, 0);
+}
+
 // Return a locked buf with the contents of the indicated block.
 struct buf*
 bread(uint dev, uint blockno)
@@ -146,6 +214,19 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block holding the
+// BSIZE bytes at data, without reading the disk.
+struct buf*
+bfill(uint dev, uint blockno, char *data)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memmove(b->data, data, BSIZE);
+  b->flags |= B_VALID;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -180,6 +261,31 @@ brelse(struct buf *b)
   
   release(&bcache.lock);
 }
+
+// Release a locked buffer that will not be needed again soon,
+// such as a block of file data, which the page cache keeps.
+// Move it to the tail of the MRU list, to be recycled first.
+void
+bforget(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bforget");
+
+  releasesleep(&b->lock);
+
+  acquire(&bcache.lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+    b->next = &bcache.head;
+    b->prev = bcache.head.prev;
+    bcache.head.prev->next = b;
+    bcache.head.prev = b;
+  }
+
+  release(&bcache.lock);
+}
 //PAGEBREAK!
 // Blank page.
 
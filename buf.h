@@ -8,6 +8,10 @@ struct buf {
   struct buf *next;
   struct buf *qnext; // disk queue
   uchar data[BSIZE];
+  char **pages;      // swap I/O: nblk blocks in these pages, not data,
+  uint boff;         // starting with block boff of pages[0]
+  uint nblk;
+  uint nxfer;        // blocks of a swap I/O transferred so far
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
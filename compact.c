@@ -0,0 +1,222 @@
+// Memory compaction.
+//
+// Superpages and other large contiguous allocations need a
+// free, aligned block of 2^MAXORDER pages, which a busy system
+// soon fragments away.  Compaction picks the 4 MB-aligned block
+// that is nearest to free and moves the user pages in it
+// elsewhere, copying each one and repointing the PTE that maps
+// it, until the whole block is free and the buddy allocator
+// merges it.  The reverse map (rmap) records, for each user
+// page, the page table and address it is mapped at.
+//
+// A page is moved only if it belongs to a process that is not
+// running, so that no TLB holds its translation; ptable.lock
+// is held while it is moved, so that the process cannot start
+// running meanwhile.  Pages of running processes, pages the
+// kernel is working on (swap_pages clears their rmap entry),
+// superpages, page tables and kernel memory do not move, and a
+// block holding any of them is passed over.
+//
+// compact() runs when a large allocation fails; idle CPUs
+// call compactidle() to do a little at a time.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "paging.h"
+#include "kmem.h"
+
+#define NCOMPACT    16   // pages an idle CPU moves per tick
+#define COMPACTIVL  100  // ticks compaction waits after failing
+
+static struct rmap {
+  pde_t *pgdir;          // 0 if the page cannot be moved
+  uint va;
+} *rmap;
+
+static uint lastfail;    // ticks when compact() last failed
+static uint lastidle;    // ticks when compactidle() last ran
+
+// Allocate the reverse map, one entry per physical page.
+// Must run after kinit2().
+void
+compactinit(void)
+{
+  int order;
+
+  for(order = 0; (PGSIZE << order) < phystop/PGSIZE * sizeof(*rmap); order++)
+    ;
+  if((rmap = (struct rmap*)kallocpages(order)) == 0)
+    panic("compactinit");
+  memset(rmap, 0, PGSIZE << order);
+  lastfail = -COMPACTIVL;
+}
+
+// Record that the user page at pa is mapped at va in pgdir.
+void
+rmapset(uint pa, pde_t *pgdir, uint va)
+{
+  if(rmap){
+    rmap[pa/PGSIZE].pgdir = pgdir;
+    rmap[pa/PGSIZE].va = va;
+  }
+}
+
+// The page at pa is no longer a movable user page.
+void
+rmapclear(uint pa)
+{
+  if(rmap)
+    rmap[pa/PGSIZE].pgdir = 0;
+}
+
+// Allocate a page outside [lo, hi), keeping any pages inside
+// it that kalloc() returns on the list held.
+static char*
+allocoutside(uint lo, uint hi, char **held)
+{
+  char *mem;
+
+  while((mem = kalloc()) != 0 && V2P(mem) >= lo && V2P(mem) < hi){
+    *(char**)mem = *held;
+    *held = mem;
+  }
+  return mem;
+}
+
+// Move the user page at pa to a page outside [lo, hi).
+// Returns -1 if it cannot be moved.
+static int
+migrate(uint pa, uint lo, uint hi, char **held)
+{
+  struct rmap r;
+  pte_t *pte;
+  char *mem;
+
+  if((mem = allocoutside(lo, hi, held)) == 0)
+    return -1;
+  lockptable();
+  r = rmap[pa/PGSIZE];
+  if(r.pgdir == 0 || !pgdirstopped(r.pgdir) ||
+     (pte = uva2pte(r.pgdir, r.va)) == 0 ||
+     !(*pte & PTE_P) || PTE_ADDR(*pte) != pa){
+    unlockptable();
+    kfree(mem);
+    return -1;
+  }
+  memmove(mem, P2V(pa), PGSIZE);
+  *pte = V2P(mem) | PTE_FLAGS(*pte);
+  rmap[V2P(mem)/PGSIZE] = r;
+  rmap[pa/PGSIZE].pgdir = 0;
+  pagepolicy->free(pa);
+  pagepolicy->fault(V2P(mem));
+  unlockptable();
+  kfree(P2V(pa));
+  vmstat.migrated++;
+  return 0;
+}
+
+// Move up to max pages out of the block that needs the fewest
+// moves to become free.  Returns 1 if that block is now free
+// on the buddy lists, 0 if it is not yet, and -1 if no page
+// could be moved.
+static int
+compactsome(int max)
+{
+  uint b, best, pa, nmove, min;
+  char *held, *mem;
+  int moved;
+
+  best = 0;
+  min = NPTENTRIES + 1;
+  for(b = 0; b + SPGSIZE <= phystop; b += SPGSIZE){
+    nmove = 0;
+    for(pa = b; pa < b + SPGSIZE; pa += PGSIZE){
+      if(kframefree(pa))
+        continue;
+      if(rmap[pa/PGSIZE].pgdir == 0)
+        break;
+      nmove++;
+    }
+    if(pa == b + SPGSIZE && nmove < min){
+      best = b;
+      min = nmove;
+    }
+  }
+  if(min > NPTENTRIES)
+    return -1;  // every block holds pages that cannot move
+
+  held = 0;
+  moved = 0;
+  for(pa = best; pa < best + SPGSIZE && moved < max; pa += PGSIZE){
+    if(kframefree(pa))
+      continue;
+    // A page that can no longer move keeps the block busy.
+    if(rmap[pa/PGSIZE].pgdir == 0 ||
+       migrate(pa, best, best + SPGSIZE, &held) < 0)
+      break;
+    moved++;
+  }
+  while((mem = held) != 0){
+    held = *(char**)mem;
+    kfree(mem);
+  }
+  if(pa == best + SPGSIZE){
+    // The freed pages are in this CPU's magazine; merge them,
+    // and check that nothing took one of them meanwhile.
+    kcoalesce();
+    if(kblockfree(best, MAXORDER))
+      return 1;
+  }
+  return moved > 0 ? 0 : -1;
+}
+
+// Try to make a free block of 2^MAXORDER pages, after a large
+// allocation failed.  Returns 1 if the allocation should be
+// retried.
+int
+compact(void)
+{
+  int r;
+
+  if(rmap == 0 || ticks - lastfail < COMPACTIVL)
+    return 0;
+  if(kfreecnt() < 2*NPTENTRIES)
+    return 0;  // too little free memory to be worth it
+  kcoalesce();
+  vmstat.compact++;
+  r = compactsome(NPTENTRIES);
+  kcoalesce();
+  if(r == 1)
+    vmstat.compactok++;
+  else
+    lastfail = ticks;
+  return r == 1;
+}
+
+// Called by idle CPUs: if there is no free block of 2^MAXORDER
+// pages but enough free memory for one, move a few pages
+// towards making one, at most once a tick.
+void
+compactidle(void)
+{
+  uint nblock[NORDER];
+  int r;
+
+  if(rmap == 0 || ticks == lastidle || ticks - lastfail < COMPACTIVL)
+    return;
+  lastidle = ticks;
+  if(kfreecnt() < 2*NPTENTRIES)
+    return;
+  kbuddystat(nblock, NORDER);
+  if(nblock[MAXORDER] > 0)
+    return;
+  kcoalesce();
+  if((r = compactsome(NCOMPACT)) == 1)
+    vmstat.compactok++;
+  else if(r < 0)
+    lastfail = ticks;
+  kcoalesce();
+}
@@ -1,20 +1,38 @@
 struct buf;
+struct cpage;
+struct extent;
 struct context;
 struct file;
 struct inode;
+struct kmemstat;
+struct oomevent;
 struct pipe;
+struct userfault;
 struct proc;
 struct rtcdate;
+struct slabcache;
+struct slabstat;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+struct buf*     bfill(uint, uint, char*);
+void            bforget(struct buf*);
+void            bpageread(uint, char*, uint, uint, uint);
+
+// compact.c
+void            compactinit(void);
+void            rmapset(uint, pde_t*, uint);
+void            rmapclear(uint);
+int             compact(void);
+void            compactidle(void);
 
 // console.c
 void            consoleinit(void);
@@ -43,6 +61,10 @@ struct inode*   idup(struct inode*);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
+void            iprune(struct inode*);
+void            lockicache(void);
+void            unlockicache(void);
+void            ireadpage(struct inode*, char*, uint);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -52,10 +74,12 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
+int             iextents(struct inode*, uint, struct extent*, int);
 
 // ide.c
 void            ideinit(void);
-void            ideintr(void);
+void            ideintr(int);
+uint            idesize(uint);
 void            iderw(struct buf*);
 
 // ioapic.c
@@ -63,9 +87,25 @@ void            ioapicenable(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
 
+// ramdisk.c
+void            ramdiskinit(void);
+
 // kalloc.c
+extern uint     phystop;
+void            meminit(void);
 char*           kalloc(void);
 void            kfree(char*);
+char*           kzalloc(void);
+int             kzfill(void);
+int             kfreecnt(void);
+int             kmemstat(struct kmemstat*, int);
+char*           kallocpages(int);
+void            kfreepages(char*, int);
+int             kbuddystat(uint*, int);
+void            kcoalesce(void);
+int             kframefree(uint);
+int             kblockfree(uint, int);
+int             ktotalcnt(void);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -78,6 +118,7 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(int, int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -95,7 +136,17 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pagecache.c
+void            pcinit(void);
+char*           pcpage(struct inode*, uint, int);
+char*           pcget(struct inode*, uint);
+void            pcdup(char*);
+void            pcput(char*, int);
+int             pcreclaim(void);
+int             pcdrop(struct inode*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -110,17 +161,32 @@ int             growproc(int);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
+int             oomadj(int, int);
+int             oomkill(int);
+int             oomlog(struct oomevent*, int);
+void            lockptable(void);
+void            unlockptable(void);
+int             pgdirstopped(pde_t*);
+pde_t*          procpgdir(int);
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
+pde_t*          setuvm(struct proc*, pde_t*, uint);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
 
+// slab.c
+void            slabinit(void);
+struct slabcache* slabcreate(char*, uint, void (*)(void*));
+void*           slaballoc(struct slabcache*);
+void            slabfree(struct slabcache*, void*);
+int             slabstat(struct slabstat*, int);
+
 // swtch.S
 void            swtch(struct context**, struct context*);
 
@@ -151,6 +217,8 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argrdptr(int, char**, int);
+int             argstats(char**, int, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -159,6 +227,11 @@ void            syscall(void);
 // timer.c
 void            timerinit(void);
 
+// tlb.c
+void            tlbflush(pde_t*, uint, uint);
+void            tlbintr(void);
+void            tlbpoll(void);
+
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
@@ -170,6 +243,28 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// userfault.c
+void            ufinit(void);
+int             ufalloc(struct proc*, struct file**);
+void            ufclose(struct userfault*);
+void            ufdetach(struct proc*);
+int             ufread(struct userfault*, char*, int);
+int             ufcopy(struct userfault*, uint, char*);
+int             ufault(struct proc*, uint, uint, int);
+
+// vma.c
+void            vmainit(struct proc*, uint);
+void            vmadup(struct proc*, struct proc*);
+void            vmaclear(struct proc*);
+struct vma*     findvma(struct proc*, uint);
+uint            vmaperm(struct vma*);
+int             vmaheap(struct proc*, uint);
+int             vmamap(struct proc*, uint, uint, int, int, struct file*, uint);
+int             vmaunmap(struct proc*, uint, uint);
+int             vmaprotect(struct proc*, uint, uint, int);
+int             vmafault(struct proc*, struct vma*, uint, int);
+int             vmaregister(struct proc*, uint, uint);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
@@ -181,10 +276,10 @@ void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+int             protectuvm(pde_t*, uint, uint, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
-void            clearpteu(pde_t *pgdir, char *uva);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
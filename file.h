@@ -1,10 +1,11 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_UF } type;
   int ref; // reference count
   char readable;
   char writable;
   struct pipe *pipe;
   struct inode *ip;
+  struct userfault *uf;
   uint off;
 };
 
@@ -14,8 +15,11 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // on the icache list
+  struct cpage *pages; // cached pages (pagecache.c)
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  int swap;           // in use as a swap file (swapon)?
 
   short type;         // copy of disk inode
   short major;
@@ -20,6 +20,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "paging.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
@@ -65,7 +66,8 @@ balloc(uint dev)
     bp = bread(dev, BBLOCK(b, sb));
     for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
       m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
+      // Is block free and not reserved for swapping?
+      if((bp->data[bi/8] & m) == 0 && !swapreserved(b + bi)){
         bp->data[bi/8] |= m;  // Mark block in use.
         log_write(bp);
         brelse(bp);
@@ -78,49 +80,44 @@ balloc(uint dev)
   panic("balloc: out of blocks");
 }
 
-/* Similar to balloc, except allocates eight consecutive
- * free blocks. It is okay, if you assume that the first
- * block is always 8 bytes aligned.
+/* Similar to balloc, except finds n runs of eight
+ * consecutive free blocks for n swapped-out pages, all
+ * described by the same free map block, so that they can
+ * be written with one disk request.  The first block of a
+ * run is always a multiple of BPP, so the run is exactly one
+ * byte of the free map.  The runs are not marked in the free
+ * map but reserved in memory (swapreserve), so no transaction
+ * is needed and a crash leaks nothing; balloc skips them.
+ * Returns the first block, or 0 if there is no such run.
  */
 uint
-balloc_page(uint dev)
-{  
-  int b, bi, m;
-  int b_first, b_last, bi_first;
+balloc_pages(uint dev, int n)
+{
+  int b, bi, first, run;
   struct buf *bp;
 
-  bp = 0;
-  b_first = 0;
-  bi_first = 0;
-  for(b = 0; b < sb.size; b+= BPB){
+  for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    // num_free_blocks = 0;
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){
-        b_last = b;
-        if( b_last == b_first ){
-          bi_first = bi;
-        }
-        bp->data[bi/8] |= m;
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-      }
-      else {
-        b_first = b+1;
-        b_last = b+1;
-      }
-      if( b_last - b_first == (8 - 1) ) {
-        // result yaha hai
-        return b_first + bi_first;
+    run = 0;
+    for(bi = 0; bi < BPB && b + bi + BPP <= sb.size; bi += BPP){
+      // Is any of the eight blocks in use?
+      if(bp->data[bi/8] != 0 || swapreserved(b + bi)){
+        run = 0;
+        continue;
       }
+      if(++run < n)
+        continue;
+      first = bi - (n-1)*BPP;
+      // Reserve before brelse, so balloc cannot take them.
+      swapreserve(b + first, n);
+      brelse(bp);
+      return b + first;
     }
     brelse(bp);
   }
-  panic("Ran out of blocks! - CUSTOM");
-	// return -1;
+  return 0;
 }
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -139,29 +136,6 @@ bfree(int dev, uint b)
   brelse(bp);
 }
 
-/* Free disk blocks allocated using balloc_page.
- */
-void
-bfree_page(int dev, uint b)
-{
-  struct buf *bp;
-  int bi, m;
-
-  readsb(dev, &sb);
-  for(uint i = b; i < b + 8; i++){
-    bp = bread(dev, BBLOCK(i, sb));
-    bi = i % BPB;
-    m = 1 << (bi % 8);
-    if(( bp->data[bi/8] & m) == 0){
-      panic("freeing free block - CUSTOM");
-    } 
-    bp->data[bi/8] &= ~m;
-    log_write(bp);
-    brelse(bp);
-  }
-}
-
-
 // Inodes.
 //
 // An inode describes a single unnamed file.
@@ -188,7 +162,7 @@ bfree_page(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
+//   is freed when ip->ref falls to zero. ip->ref tracks
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
@@ -222,10 +196,17 @@ bfree_page(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// The icache.lock spin-lock protects the list of cached inodes.
+// An inode is allocated from a slab cache by iget() and freed
+// when its ref drops to zero, so the number of inodes in use
+// is limited only by memory.  An inode whose data is still in
+// the page cache stays on the list with ref 0, so that opening
+// the file again finds the data; the page cache frees it with
+// its last page (iprune()).  The pages of an inode with ref 0
+// change only with both icache.lock and the page cache's lock
+// held.  Since ip->dev and ip->inum
+// indicate which i-node an entry holds, one must hold
+// icache.lock while using ip->ref, ip->dev, ip->inum or ip->next.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -233,18 +214,22 @@ bfree_page(int dev, uint b)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *list;     // inodes with ref > 0 or cached pages
+  struct slabcache *cache;
 } icache;
 
+static void
+inodector(void *ip)
+{
+  initsleeplock(&((struct inode*)ip)->lock, "inode");
+  ((struct inode*)ip)->pages = 0;
+}
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = slabcreate("inode", sizeof(struct inode), inodector);
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
@@ -258,23 +243,31 @@ static struct inode* iget(uint dev, uint inum);
 //PAGEBREAK!
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
-// Returns an unlocked but allocated and referenced inode.
+// Returns an unlocked but allocated and referenced inode,
+// or 0 if there is no memory for it.
 struct inode*
 ialloc(uint dev, short type)
 {
   int inum;
   struct buf *bp;
   struct dinode *dip;
+  struct inode *ip;
 
   for(inum = 1; inum < sb.ninodes; inum++){
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
+      // Get the in-memory inode first, so that failing
+      // leaves the disk inode free.
+      if((ip = iget(dev, inum)) == 0){
+        brelse(bp);
+        return 0;
+      }
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
-      return iget(dev, inum);
+      return ip;
     }
     brelse(bp);
   }
@@ -306,34 +299,35 @@ iupdate(struct inode *ip)
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// Returns 0 if there is no memory for a new one.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = icache.list; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  // Allocate a new entry.
+  if((ip = slaballoc(icache.cache)) == 0){
+    release(&icache.lock);
+    return 0;
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->swap = 0;
+  ip->next = icache.list;
+  icache.list = ip;
   release(&icache.lock);
 
   return ip;
@@ -390,8 +384,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry is
+// freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -415,7 +409,38 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  --ip->ref;
+  iprune(ip);
+  release(&icache.lock);
+}
+
+// Free ip if nothing refers to it and it has no cached pages.
+// Caller holds icache.lock, which pcreclaim() takes (with
+// lockicache()) before it drops a page of an unreferenced
+// inode, so ip->pages cannot change under us.
+void
+iprune(struct inode *ip)
+{
+  struct inode **pp;
+
+  if(ip->ref != 0 || ip->pages != 0)
+    return;
+  for(pp = &icache.list; *pp != ip; pp = &(*pp)->next)
+    ;
+  *pp = ip->next;
+  slabfree(icache.cache, ip);
+}
+
+// Take and release icache.lock, for pcreclaim().
+void
+lockicache(void)
+{
+  acquire(&icache.lock);
+}
+
+void
+unlockicache(void)
+{
   release(&icache.lock);
 }
 
@@ -467,6 +492,35 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Resolve the first nblk blocks of ip, which must all
+// exist, into runs of consecutive disk blocks.  Returns
+// the number of extents, or -1 if there are more than max.
+// Caller must hold ip->lock.
+int
+iextents(struct inode *ip, uint nblk, struct extent *ext, int max)
+{
+  uint bn, addr;
+  int n;
+
+  if(nblk*BSIZE > ip->size)
+    return -1;
+  n = 0;
+  for(bn = 0; bn < nblk; bn++){
+    addr = bmap(ip, bn);
+    if(n > 0 && ext[n-1].dblk + ext[n-1].len == addr){
+      ext[n-1].len++;
+      continue;
+    }
+    if(n == max)
+      return -1;
+    ext[n].fblk = bn;
+    ext[n].dblk = addr;
+    ext[n].len = 1;
+    n++;
+  }
+  return n;
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -479,6 +533,8 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  if(pcdrop(ip) < 0)
+    panic("itrunc pages");
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -515,6 +571,26 @@ stati(struct inode *ip, struct stat *st)
 }
 
 //PAGEBREAK!
+// Read the page of regular file ip at offset off into pg
+// for the page cache, straight from the disk, zero-filled
+// past the end of the file.  Caller must hold ip->lock.
+void
+ireadpage(struct inode *ip, char *pg, uint off)
+{
+  uint i, j, n, bn, addr;
+
+  n = off < ip->size ? min(ip->size - off, PGSIZE) : 0;
+  bn = off / BSIZE;
+  // Read each run of consecutive blocks with one request.
+  for(i = 0; i*BSIZE < n; i = j){
+    addr = bmap(ip, bn + i);
+    for(j = i + 1; j*BSIZE < n && bmap(ip, bn + j) == addr + j - i; j++)
+      ;
+    bpageread(ip->dev, pg, i, j - i, addr);
+  }
+  memset(pg + n, 0, PGSIZE - n);
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 int
@@ -522,6 +598,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  char *pg;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -534,6 +611,17 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->type == T_FILE && !ip->swap){
+    for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+      if((pg = pcpage(ip, PGROUNDDOWN(off), 1)) == 0)
+        return -1;
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      memmove(dst, pg + off%PGSIZE, m);
+      pcput(pg, 0);
+    }
+    return n;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -549,8 +637,12 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, bn;
   struct buf *bp;
+  char *pg;
+
+  if(ip->swap)
+    return -1;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -563,12 +655,31 @@ writei(struct inode *ip, char *src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(bp->data + off%BSIZE, src, m);
-    log_write(bp);
-    brelse(bp);
+  if(ip->type == T_FILE){
+    // Write into the page cache, then log the blocks written;
+    // a page being overwritten whole need not be read first.
+    for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      if((pg = pcpage(ip, PGROUNDDOWN(off), m < PGSIZE)) == 0)
+        break;
+      memmove(pg + off%PGSIZE, src, m);
+      for(bn = off/BSIZE; bn*BSIZE < off + m; bn++){
+        bp = bfill(ip->dev, bmap(ip, bn), pg + (bn*BSIZE)%PGSIZE);
+        log_write(bp);
+        bforget(bp);
+      }
+      pcput(pg, 0);
+    }
+    if(tot < n)
+      n = tot;
+  } else {
+    for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+      bp = bread(ip->dev, bmap(ip, off/BSIZE));
+      m = min(n - tot, BSIZE - off%BSIZE);
+      memmove(bp->data + off%BSIZE, src, m);
+      log_write(bp);
+      brelse(bp);
+    }
   }
 
   if(n > 0 && off > ip->size){
@@ -589,6 +700,8 @@ namecmp(const char *s, const char *t)
 
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Returns 0 if not found or if there is no memory
+// for the inode.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
@@ -621,12 +734,15 @@ dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
   struct dirent de;
-  struct inode *ip;
 
-  // Check that name is not present.
-  if((ip = dirlookup(dp, name, 0)) != 0){
-    iput(ip);
-    return -1;
+  // Check that name is not present.  Compare the names
+  // rather than dirlookup(), which can fail for want of
+  // memory for the inode.
+  for(off = 0; off < dp->size; off += sizeof(de)){
+    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirlink read");
+    if(de.inum != 0 && namecmp(name, de.name) == 0)
+      return -1;
   }
 
   // Look for an empty dirent.
@@ -694,9 +810,10 @@ namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
 
-  if(*path == '/')
-    ip = iget(ROOTDEV, ROOTINO);
-  else
+  if(*path == '/'){
+    if((ip = iget(ROOTDEV, ROOTINO)) == 0)
+      return 0;
+  } else
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
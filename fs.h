@@ -47,6 +47,10 @@ struct dinode {
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) (b/BPB + sb.bmapstart)
 
+// Blocks per swapped-out page.  Must be 8, so that the bits of
+// one swap slot make up exactly one byte of the free map.
+#define BPP           8
+
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
@@ -56,7 +60,14 @@ struct dirent {
 };
 
 
-uint balloc_page(uint dev);
-void bfree_page(int dev, uint b);
+// A run of file blocks in consecutive disk blocks.
+struct extent {
+  uint fblk;  // first file block
+  uint dblk;  // its disk block
+  uint len;   // number of blocks
+};
+
+uint balloc_pages(uint dev, int n);
 void write_page_to_disk(uint dev, char *pg, uint blk);
+void swaprw(uint dev, char **pages, uint first, uint nblk, uint blk, int write);
 void read_page_from_disk(uint dev, char *pg, uint blk);
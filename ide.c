@@ -17,65 +17,126 @@
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
 #define IDE_DF        0x20
+#define IDE_DRQ       0x08
 #define IDE_ERR       0x01
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_IDENTIFY 0xec
+
+// Disks are numbered by channel and drive: 0 and 1 are the
+// master and slave on the primary channel (the boot disk and
+// the file system), 2 and 3 those on the secondary channel.
+// Each channel has its own request queue and interrupt, so
+// I/O to a disk there (swap, see swap.c) proceeds alongside
+// file system I/O.
+//
+// c->queue points to the buf now being read/written to the disk.
+// c->queue->qnext points to the next buf to be processed.
+// You must hold c->lock while manipulating queue.
+
+static struct idechan {
+  ushort base;          // command block registers
+  ushort ctl;           // device control register
+  int irq;
+  struct spinlock lock;
+  struct buf *queue;
+  uint nsect[2];        // sectors on each drive, 0 if none
+} idechan[NDISK/2] = {
+  { 0x1f0, 0x3f6, IRQ_IDE },
+  { 0x170, 0x376, IRQ_IDE2 },
+};
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
-
-static struct spinlock idelock;
-static struct buf *idequeue;
-
-static int havedisk1;
 static void idestart(struct buf*);
 
+// Address of the i'th block of b's data.
+static uchar*
+bdata(struct buf *b, uint i)
+{
+  if(b->pages == 0)
+    return b->data;
+  i += b->boff;
+  return (uchar*)b->pages[i/BPP] + (i%BPP)*BSIZE;
+}
+
 // Wait for IDE disk to become ready.
 static int
-idewait(int checkerr)
+idewait(struct idechan *c, int checkerr)
 {
   int r;
 
-  while(((r = inb(0x1f7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+  while(((r = inb(c->base+7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
     ;
   if(checkerr && (r & (IDE_DF|IDE_ERR)) != 0)
     return -1;
   return 0;
 }
 
+// Return the size in sectors of drive d on channel c,
+// or 0 if there is no such disk.  Polls, with the
+// channel's interrupt disabled.
+static uint
+ideidentify(struct idechan *c, int d)
+{
+  uint id[128];
+  int i, r;
+
+  outb(c->ctl, 0x02);  // nIEN
+  outb(c->base+6, 0xe0 | (d<<4));
+  outb(c->base+7, IDE_CMD_IDENTIFY);
+  for(i = 0; i < 100000; i++){
+    r = inb(c->base+7);
+    if(r == 0 || r == 0xff)  // nothing there
+      return 0;
+    if(!(r & IDE_BSY))
+      break;
+  }
+  if(i == 100000 || (r & (IDE_ERR|IDE_DRQ)) != IDE_DRQ)
+    return 0;
+  insl(c->base, id, 128);
+  return id[30];  // words 60-61: sectors addressable with LBA28
+}
+
 void
 ideinit(void)
 {
-  int i;
-
-  initlock(&idelock, "ide");
-  ioapicenable(IRQ_IDE, ncpu - 1);
-  idewait(0);
-
-  // Check if disk 1 is present
-  outb(0x1f6, 0xe0 | (1<<4));
-  for(i=0; i<1000; i++){
-    if(inb(0x1f7) != 0){
-      havedisk1 = 1;
-      break;
-    }
+  struct idechan *c;
+  int d;
+
+  for(c = idechan; c < &idechan[NDISK/2]; c++){
+    initlock(&c->lock, "ide");
+    for(d = 0; d < 2; d++)
+      c->nsect[d] = ideidentify(c, d);
+    outb(c->base+6, 0xe0);  // back to drive 0
+    outb(c->ctl, 0);
+    if(c->nsect[0] || c->nsect[1])
+      ioapicenable(c->irq, ncpu - 1);
   }
+}
 
-  // Switch back to disk 0.
-  outb(0x1f6, 0xe0 | (0<<4));
+// Return the number of blocks on disk dev, 0 if there is none.
+uint
+idesize(uint dev)
+{
+  if(dev >= NDISK)
+    return 0;
+  return idechan[dev/2].nsect[dev%2] / (BSIZE/SECTOR_SIZE);
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for b.  Caller must hold the channel lock.
+// A swap request (b->pages set) is a single command for
+// all its sectors, one interrupt per sector; ideintr
+// moves the data a sector at a time.
 static void
 idestart(struct buf *b)
 {
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  struct idechan *c = &idechan[b->dev/2];
+  int nblk = b->pages ? b->nblk : 1;
+  if(b->blockno + nblk > idesize(b->dev))
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
@@ -83,40 +144,54 @@ idestart(struct buf *b)
   int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   if (sector_per_block > 7) panic("idestart");
-
-  idewait(0);
-  outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
-  outb(0x1f3, sector & 0xff);
-  outb(0x1f4, (sector >> 8) & 0xff);
-  outb(0x1f5, (sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
+  if(b->pages && (sector_per_block != 1 || nblk > 256))
+    panic("idestart: swap request");
+  b->nxfer = 0;
+
+  idewait(c, 0);
+  outb(c->ctl, 0);  // generate interrupt
+  outb(c->base+2, (sector_per_block*nblk) & 0xff);  // number of sectors, 0 is 256
+  outb(c->base+3, sector & 0xff);
+  outb(c->base+4, (sector >> 8) & 0xff);
+  outb(c->base+5, (sector >> 16) & 0xff);
+  outb(c->base+6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    outb(c->base+7, write_cmd);
+    outsl(c->base, bdata(b, 0), BSIZE/4);
   } else {
-    outb(0x1f7, read_cmd);
+    outb(c->base+7, read_cmd);
   }
 }
 
-// Interrupt handler.
+// Interrupt handler for channel chan.
 void
-ideintr(void)
+ideintr(int chan)
 {
+  struct idechan *c = &idechan[chan];
   struct buf *b;
 
   // First queued buffer is the active request.
-  acquire(&idelock);
+  acquire(&c->lock);
 
-  if((b = idequeue) == 0){
-    release(&idelock);
+  if((b = c->queue) == 0){
+    release(&c->lock);
     return;
   }
-  idequeue = b->qnext;
 
   // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(!(b->flags & B_DIRTY) && idewait(c, 1) >= 0)
+    insl(c->base, bdata(b, b->nxfer), BSIZE/4);
+
+  // More sectors of a swap request to go?
+  if(b->pages && ++b->nxfer < b->nblk){
+    if(b->flags & B_DIRTY){
+      idewait(c, 0);
+      outsl(c->base, bdata(b, b->nxfer), BSIZE/4);
+    }
+    release(&c->lock);
+    return;
+  }
+  c->queue = b->qnext;
 
   // Wake process waiting for this buf.
   b->flags |= B_VALID;
@@ -124,10 +199,10 @@ ideintr(void)
   wakeup(b);
 
   // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  if(c->queue != 0)
+    idestart(c->queue);
 
-  release(&idelock);
+  release(&c->lock);
 }
 
 //PAGEBREAK!
@@ -137,32 +212,34 @@ ideintr(void)
 void
 iderw(struct buf *b)
 {
+  struct idechan *c;
   struct buf **pp;
 
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
     panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
+  if(idesize(b->dev) == 0)
+    panic("iderw: ide disk not present");
+  c = &idechan[b->dev/2];
 
-  acquire(&idelock);  //DOC:acquire-lock
+  acquire(&c->lock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
+  // Append b to the queue.
   b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+  for(pp=&c->queue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
     ;
   *pp = b;
 
   // Start disk if necessary.
-  if(idequeue == b)
+  if(c->queue == b)
     idestart(b);
 
   // Wait for request to finish.
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
+    sleep(b, &c->lock);
   }
 
 
-  release(&idelock);
+  release(&c->lock);
 }
@@ -1,6 +1,22 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, or blocks of
+// 2^order physically contiguous pages (kallocpages).
+//
+// Free memory is kept by a buddy allocator: a list of free
+// blocks for each order up to MAXORDER, each block aligned to
+// its size.  Splitting a block gives two buddies of the order
+// below; when both are free again they are merged on free.
+//
+// Besides the free list there is a pool of free pages that
+// are already zeroed, kept filled by idle CPUs (kzfill), so
+// that kzalloc() seldom has to zero a page itself.
+//
+// Each CPU also keeps a magazine of up to KMAGSIZE free pages
+// of its own, so that most kalloc() and kfree() calls do not
+// take kmem.lock.  An empty magazine is refilled from the free
+// list, and a full one drained to it, KMAGSIZE/2 pages at a
+// time.
 
 #include "types.h"
 #include "defs.h"
@@ -8,32 +24,127 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "proc.h"
+#include "kmem.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+#define PFN(v)  (V2P(v) / PGSIZE)
+
 struct run {
   struct run *next;
+  struct run *prev;      // on the buddy lists only
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *free[NORDER];  // free blocks of each order
+  int nblock[NORDER];        // blocks on free[]
+  uchar *order;              // per frame up to phystop: 1 + order of a
+                             // free block starting there, or 0
+  uint nframe;               // frames below phystop
+  struct run *zerolist;  // zeroed pages, but for run.next
+  int nzero;             // pages on zerolist
+  int nfree;             // free pages, on the buddy lists or zerolist
+  int ntotal;            // pages given to the allocator at boot
 } kmem;
 
+struct kmag {
+  struct spinlock lock;  // only other CPUs stealing contend for it
+  struct run *list;
+  int n;
+  struct kmemstat st;
+};
+
+static struct kmag kmag[NCPU];
+
+//PAGEBREAK: 20
+// Physical memory, as the BIOS describes it (see bootasm.S).
+
+struct e820 {
+  uint addr;
+  uint addrhi;
+  uint len;
+  uint lenhi;
+  uint type;
+};
+
+#define E820_RAM  1   // usable memory
+#define NE820    64
+
+uint phystop;         // top of the physical memory the kernel uses
+static struct e820 *e820;
+static int ne820;
+
+// Find out how much physical memory there is.  Without a
+// memory map from the BIOS, assume the 4 MB entrypgdir maps.
+void
+meminit(void)
+{
+  struct e820 *e;
+  uint top, lim;
+
+  e820 = (struct e820*)P2V(E820MAP+4);
+  ne820 = (*(ushort*)P2V(E820MAP) - (E820MAP+4)) / sizeof(*e820);
+  if(ne820 < 1 || ne820 > NE820)
+    ne820 = 0;
+
+  lim = PHYSMAX;
+  if(lim > DEVSPACE - KERNBASE)
+    lim = DEVSPACE - KERNBASE;
+  phystop = 4*1024*1024;
+  for(e = e820; e < &e820[ne820]; e++){
+    if(e->type != E820_RAM || e->addrhi != 0)
+      continue;
+    top = e->addr + e->len;
+    if(e->lenhi != 0 || top < e->addr || top > lim)
+      top = lim;
+    if(top > phystop)
+      phystop = PGROUNDDOWN(top);
+  }
+}
+
+// Is the page at physical address pa memory that the BIOS
+// has not reserved?
+static int
+usable(uint pa)
+{
+  struct e820 *e;
+
+  if(ne820 == 0)
+    return pa < phystop;
+  for(e = e820; e < &e820[ne820]; e++){
+    if(e->type != E820_RAM || e->addrhi != 0 || pa < e->addr)
+      continue;
+    if(e->lenhi != 0 || pa + PGSIZE - e->addr <= e->len)
+      return 1;
+  }
+  return 0;
+}
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// The buddy allocator's own per-frame table cannot come from
+// it, so kinit1() takes it from the start of its pages.
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmag[i].lock, "kmag");
   kmem.use_lock = 0;
-  freerange(vstart, vend);
+  kmem.nframe = phystop / PGSIZE;
+  kmem.order = (uchar*)PGROUNDUP((uint)vstart);
+  memset(kmem.order, 0, kmem.nframe);
+  freerange(kmem.order + PGROUNDUP(kmem.nframe), vend);
 }
 
 void
@@ -48,9 +159,105 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    if(!usable(V2P(p)))
+      continue;
     kfree(p);
+    kmem.ntotal++;
+  }
+}
+//PAGEBREAK: 30
+// Buddy lists.  Callers hold kmem.lock if use_lock is set.
+
+static void
+bpush(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.free[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[order] = r;
+  kmem.order[PFN(r)] = order + 1;
+  kmem.nblock[order]++;
+}
+
+static void
+bremove(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.order[PFN(r)] = 0;
+  kmem.nblock[order]--;
+}
+
+// Take a block of 2^order pages, splitting a larger one
+// if there is none that size.
+static struct run*
+balloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k < NORDER && kmem.free[k] == 0; k++)
+    ;
+  if(k == NORDER)
+    return 0;
+  r = kmem.free[k];
+  bremove(r, k);
+  while(k > order){
+    k--;
+    bpush((struct run*)((char*)r + (PGSIZE << k)), k);
+  }
+  kmem.nfree -= 1 << order;
+  return r;
 }
+
+// Give back a block of 2^order pages, merging it with its
+// buddy for as long as the buddy is free and whole.
+static void
+bfree(struct run *r, int order)
+{
+  uint pfn, b;
+
+  kmem.nfree += 1 << order;
+  pfn = PFN(r);
+  for(; order < MAXORDER; order++){
+    b = pfn ^ (1 << order);
+    if(b >= kmem.nframe || kmem.order[b] != order + 1)
+      break;
+    bremove((struct run*)P2V(b * PGSIZE), order);
+    pfn &= ~(1 << order);
+  }
+  bpush((struct run*)P2V(pfn * PGSIZE), order);
+}
+
+// Take kmem.lock on behalf of magazine m, counting the
+// times another CPU already held it.
+static void
+kmemlock(struct kmag *m)
+{
+  if(kmem.lock.locked)
+    m->st.contended++;
+  acquire(&kmem.lock);
+}
+
+// Lock and return this CPU's magazine.
+static struct kmag*
+mymag(void)
+{
+  struct kmag *m;
+
+  pushcli();
+  m = &kmag[cpuid()];
+  acquire(&m->lock);
+  popcli();
+  return m;
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -60,20 +267,74 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct kmag *m;
+  int i;
 
-  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
     panic("kfree");
 
-  // Fill with junk to catch dangling refs.
-  memset(v, 1, PGSIZE);
-
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    bfree(r, 0);
+    return;
+  }
+
+  m = mymag();
+  if(m->n < KMAGSIZE)
+    m->st.freehit++;
+  else {
+    m->st.freemiss++;
+    m->st.drain++;
+    kmemlock(m);
+    for(i = 0; i < KMAGSIZE/2; i++){
+      r = m->list;
+      m->list = r->next;
+      m->n--;
+      bfree(r, 0);
+    }
     release(&kmem.lock);
+    r = (struct run*)v;
+  }
+  r->next = m->list;
+  m->list = r;
+  m->n++;
+  release(&m->lock);
+}
+
+// Take a free page from the buddy lists, or failing that from
+// the zeroed pool.  Caller holds kmem.lock if use_lock is set.
+static struct run*
+kget(void)
+{
+  struct run *r;
+
+  if((r = balloc(0)) == 0 && (r = kmem.zerolist) != 0){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+    kmem.nfree--;
+  }
+  return r;
+}
+
+// Take a page from another CPU's magazine, when the free
+// lists have run dry.
+static struct run*
+ksteal(void)
+{
+  struct run *r;
+  struct kmag *m;
+
+  for(m = kmag; m < &kmag[NCPU]; m++){
+    acquire(&m->lock);
+    if((r = m->list) != 0){
+      m->list = r->next;
+      m->n--;
+      release(&m->lock);
+      return r;
+    }
+    release(&m->lock);
+  }
+  return 0;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -81,16 +342,245 @@ kfree(char *v)
 // Returns 0 if the memory cannot be allocated.
 char*
 kalloc(void)
+{
+  struct run *r;
+  struct kmag *m;
+
+  if(!kmem.use_lock)
+    return (char*)kget();
+
+  m = mymag();
+  if(m->n > 0)
+    m->st.allochit++;
+  else {
+    m->st.allocmiss++;
+    m->st.refill++;
+    kmemlock(m);
+    while(m->n < KMAGSIZE/2 && (r = kget()) != 0){
+      r->next = m->list;
+      m->list = r;
+      m->n++;
+    }
+    release(&kmem.lock);
+  }
+  if((r = m->list) != 0){
+    m->list = r->next;
+    m->n--;
+  }
+  release(&m->lock);
+  if(r == 0)
+    r = ksteal();
+  return (char*)r;
+}
+
+// Give every CPU's magazine and the zeroed pool back to the
+// buddy lists, so that their pages can merge again.
+void
+kcoalesce(void)
+{
+  struct kmag *m;
+  struct run *r;
+
+  for(m = kmag; m < &kmag[NCPU]; m++){
+    acquire(&m->lock);
+    acquire(&kmem.lock);
+    while((r = m->list) != 0){
+      m->list = r->next;
+      m->n--;
+      bfree(r, 0);
+    }
+    release(&kmem.lock);
+    release(&m->lock);
+  }
+  acquire(&kmem.lock);
+  while((r = kmem.zerolist) != 0){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+    kmem.nfree--;
+    bfree(r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Is the page at physical address pa on the buddy lists?
+// Only a hint: read without the lock.
+int
+kframefree(uint pa)
+{
+  uint pfn;
+  int k;
+
+  pfn = pa / PGSIZE;
+  for(k = 0; k < NORDER; k++)
+    if(kmem.order[pfn & ~((1 << k) - 1)] == k + 1)
+      return 1;
+  return 0;
+}
+
+// Is the block of 2^order pages at physical address pa free,
+// as a whole, on the buddy lists?
+int
+kblockfree(uint pa, int order)
+{
+  int r;
+
+  acquire(&kmem.lock);
+  r = kmem.order[pa/PGSIZE] == order + 1;
+  release(&kmem.lock);
+  return r;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size.  Returns 0 if the memory cannot be allocated.
+char*
+kallocpages(int order)
 {
   struct run *r;
 
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  r = balloc(order);
   if(kmem.use_lock)
     release(&kmem.lock);
+  if(r == 0 && kmem.use_lock && kfreecnt() >= (1 << order)){
+    // Pages held in magazines may be what keeps the
+    // buddies apart.
+    kcoalesce();
+    acquire(&kmem.lock);
+    r = balloc(order);
+    release(&kmem.lock);
+  }
   return (char*)r;
 }
 
+// Free 2^order pages returned by kallocpages(order).
+void
+kfreepages(char *v, int order)
+{
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if((uint)v % (PGSIZE << order) || v < end || V2P(v) >= phystop)
+    panic("kfreepages");
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  bfree((struct run*)v, order);
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+// Allocate one zeroed page, from the pool of pages zeroed
+// by idle CPUs if it has any.
+// Returns 0 if the memory cannot be allocated.
+char*
+kzalloc(void)
+{
+  struct run *r;
+  char *v;
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  r = kmem.zerolist;
+  if(r){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+    kmem.nfree--;
+  }
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  if(r){
+    r->next = 0;
+    return (char*)r;
+  }
+  if((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Zero a page from the buddy lists and add it to the zeroed
+// pool, unless the pool already holds NZEROPAGE.  Called by
+// idle CPUs.  Returns 0 if there was nothing to do.
+int
+kzfill(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  if(kmem.nzero >= NZEROPAGE || (r = balloc(0)) == 0){
+    release(&kmem.lock);
+    return 0;
+  }
+  release(&kmem.lock);
+
+  memset(r, 0, PGSIZE);
+
+  acquire(&kmem.lock);
+  r->next = kmem.zerolist;
+  kmem.zerolist = r;
+  kmem.nzero++;
+  kmem.nfree++;
+  release(&kmem.lock);
+  return 1;
+}
+
+
+// Return the number of free pages, magazines included.
+// Only a hint: it may change as soon as it has been read.
+int
+kfreecnt(void)
+{
+  struct kmag *m;
+  int n;
+
+  n = kmem.nfree;
+  for(m = kmag; m < &kmag[NCPU]; m++)
+    n += m->n;
+  return n;
+}
+
+// Return the number of pages the allocator manages.
+int
+ktotalcnt(void)
+{
+  return kmem.ntotal;
+}
+
+// Copy out the magazine counters of up to n CPUs.
+// Returns the number of CPUs copied.
+int
+kmemstat(struct kmemstat *st, int n)
+{
+  int i;
+
+  if(n > ncpu)
+    n = ncpu;
+  for(i = 0; i < n; i++){
+    acquire(&kmag[i].lock);
+    st[i] = kmag[i].st;
+    st[i].cpu = i;
+    st[i].cached = kmag[i].n;
+    release(&kmag[i].lock);
+  }
+  return n;
+}
+
+// Copy out the number of free blocks of each order, for up
+// to n orders.  Returns the number of orders copied.
+int
+kbuddystat(uint *nblock, int n)
+{
+  int i;
+
+  if(n > NORDER)
+    n = NORDER;
+  acquire(&kmem.lock);
+  for(i = 0; i < n; i++)
+    nblock[i] = kmem.nblock[i];
+  release(&kmem.lock);
+  return n;
+}
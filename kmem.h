@@ -0,0 +1,53 @@
+// Physical page allocator statistics.
+// Both the kernel and user programs use this header file.
+
+#define MAXORDER  10            // largest block: 2^10 pages, 4 MB
+#define NORDER    (MAXORDER+1)  // block sizes, as kbuddystat() counts them
+
+// One CPU's page magazine, as returned by kmemstat().
+struct kmemstat {
+  int cpu;         // CPU number
+  int cached;      // Free pages now in the magazine
+  uint allochit;   // kalloc()s served from the magazine alone
+  uint allocmiss;  // kalloc()s that had to refill it
+  uint freehit;    // kfree()s that went to the magazine alone
+  uint freemiss;   // kfree()s that had to drain it
+  uint refill;     // Batches taken from the free list
+  uint drain;      // Batches given back to the free list
+  uint contended;  // Times kmem.lock was found held by another CPU
+};
+
+// Virtual memory counters, as returned by vmstat().
+struct vmstat {
+  uint nsuper;      // 4 MB user pages mapped now
+  uint superalloc;  // 4 MB user pages mapped since boot
+  uint superfail;   // Times no free 4 MB block was found for one
+  uint supersplit;  // 4 MB user pages split into 4 KB pages
+  uint compact;     // Compactions run for a failed large allocation
+  uint compactok;   // Compactions, on demand or idle, that freed 4 MB
+  uint migrated;    // Pages moved by compaction
+  uint tlbflush;    // TLB invalidations of a run of user pages
+  uint tlbfull;     // of them done by flushing the whole TLB
+  uint tlbshoot;    // of them that interrupted other CPUs
+  uint tlbipi;      // Shootdown interrupts sent
+  uint tlbwait;     // Time spent waiting for other CPUs, in 1024 cycles
+  uint tlbmaxwait;  // Longest such wait, in cycles
+  uint filepages;   // Pages in the file page cache now
+  uint filehit;     // Mapped file pages found in the cache
+  uint fileread;    // Mapped file pages read from the file
+  uint filewrite;   // Dirty shared pages written back
+  uint filedrop;    // Unmapped pages dropped from the cache
+};
+
+// One slab cache, as returned by slabstat().
+struct slabstat {
+  char name[16];   // Cache name
+  uint size;       // Object size
+  int perslab;     // Objects in a slab (one page)
+  uint nslab;      // Slabs, and so pages, in use
+  uint inuse;      // Objects allocated
+  uint cached;     // Free objects held by CPUs
+  uint alloc;      // slaballoc()s since boot
+  uint free;       // slabfree()s since boot
+  uint hit;        // slaballoc()s served without the cache lock
+};
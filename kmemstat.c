@@ -0,0 +1,98 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "kmem.h"
+
+// kmemstat: show each CPU's page magazine counters, and
+// how often kalloc and kfree got by without kmem.lock.
+// Then show the buddy allocator's free blocks of each order
+// and, for each order, the share of free memory that is in
+// smaller blocks and so cannot serve an allocation that big.
+// Then show the slab caches of small kernel objects, and last
+// the virtual memory counters.
+
+int
+pct(uint part, uint whole)
+{
+  return whole ? part*100/whole : 100;
+}
+
+void
+fragmentation(void)
+{
+  uint nblock[NORDER], free, small;
+  int i, n;
+
+  n = kbuddystat(nblock, NORDER);
+  free = 0;
+  for(i = 0; i < n; i++)
+    free += nblock[i] << i;
+  printf(1, "order blocks pages unusable\n");
+  small = 0;
+  for(i = 0; i < n; i++){
+    printf(1, "%d %d %d %d%%\n", i, nblock[i], nblock[i] << i,
+           free ? small*100/free : 100);
+    small += nblock[i] << i;
+  }
+}
+
+void
+slabs(void)
+{
+  struct slabstat st[NSLABCACHE];
+  int i, n;
+
+  n = slabstat(st, NSLABCACHE);
+  printf(1, "cache size perslab slabs inuse cached alloc free hit\n");
+  for(i = 0; i < n; i++)
+    printf(1, "%s %d %d %d %d %d %d %d %d%%\n", st[i].name, st[i].size,
+           st[i].perslab, st[i].nslab, st[i].inuse, st[i].cached,
+           st[i].alloc, st[i].free, pct(st[i].hit, st[i].alloc));
+}
+
+void
+vm(void)
+{
+  struct vmstat st;
+
+  if(vmstat(&st) < 0)
+    return;
+  printf(1, "superpages %d, mapped %d, failed %d, split %d\n",
+         st.nsuper, st.superalloc, st.superfail, st.supersplit);
+  printf(1, "compaction %d, freed 4 MB %d, pages moved %d\n",
+         st.compact, st.compactok, st.migrated);
+  printf(1, "tlb flushes %d, full %d, shootdowns %d, ipis %d, wait %dk cycles, max %d\n",
+         st.tlbflush, st.tlbfull, st.tlbshoot, st.tlbipi, st.tlbwait,
+         st.tlbmaxwait);
+  printf(1, "page cache %d pages, hits %d, read %d, written back %d, dropped %d\n",
+         st.filepages, st.filehit, st.fileread, st.filewrite, st.filedrop);
+}
+
+int
+main(void)
+{
+  struct kmemstat st[NCPU];
+  uint ahit, amiss, fhit, fmiss, cont;
+  int i, n;
+
+  n = kmemstat(st, NCPU);
+  ahit = amiss = fhit = fmiss = cont = 0;
+  printf(1, "cpu cached allochit allocmiss freehit freemiss refill drain contended\n");
+  for(i = 0; i < n; i++){
+    printf(1, "%d %d %d %d %d %d %d %d %d\n", st[i].cpu, st[i].cached,
+           st[i].allochit, st[i].allocmiss, st[i].freehit, st[i].freemiss,
+           st[i].refill, st[i].drain, st[i].contended);
+    ahit += st[i].allochit;
+    amiss += st[i].allocmiss;
+    fhit += st[i].freehit;
+    fmiss += st[i].freemiss;
+    cont += st[i].contended;
+  }
+  printf(1, "kalloc hit %d%%, kfree hit %d%%, contended %d of %d lock takes\n",
+         pct(ahit, ahit+amiss), pct(fhit, fhit+fmiss), cont, amiss+fmiss);
+  fragmentation();
+  slabs();
+  vm();
+  exit();
+}
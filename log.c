@@ -1,6 +1,8 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -135,6 +137,8 @@ begin_op(void)
     } else {
       log.outstanding += 1;
       release(&log.lock);
+      if(myproc())
+        myproc()->nop++;
       break;
     }
   }
@@ -147,6 +151,8 @@ end_op(void)
 {
   int do_commit = 0;
 
+  if(myproc())
+    myproc()->nop--;
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
@@ -5,6 +5,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "paging.h"
 
 static void startothers(void);
 static void mpmain(void)  __attribute__((noreturn));
@@ -17,6 +18,7 @@ extern char end[]; // first address after kernel loaded from ELF file
 int
 main(void)
 {
+  meminit();       // detect physical memory
   kinit1(end, P2V(4*1024*1024)); // phys page allocator
   kvmalloc();      // kernel page table
   mpinit();        // detect other processors
@@ -29,10 +31,18 @@ main(void)
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  slabinit();      // kernel object caches
   fileinit();      // file table
+  pipeinit();      // pipes
+  ufinit();        // userfault objects
   ideinit();       // disk 
+  swapinit();      // swap areas, and swap disks
   startothers();   // start other processors
-  kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  kinit2(P2V(4*1024*1024), P2V(phystop)); // must come after startothers()
+  ramdiskinit();   // RAM disk for swap
+  compactinit();   // reverse map for compaction
+  pcinit();        // file page cache
+  policyinit();    // page replacement state
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -25,9 +25,16 @@ ideinit(void)
   disksize = (uint)_binary_fs_img_size/BSIZE;
 }
 
+// Return the number of blocks on disk dev, 0 if there is none.
+uint
+idesize(uint dev)
+{
+  return dev == 1 ? disksize : 0;
+}
+
 // Interrupt handler.
 void
-ideintr(void)
+ideintr(int chan)
 {
   // no-op
 }
@@ -38,7 +45,8 @@ ideintr(void)
 void
 iderw(struct buf *b)
 {
-  uchar *p;
+  uchar *p, *q;
+  int i;
 
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
@@ -46,12 +54,22 @@ iderw(struct buf *b)
     panic("iderw: nothing to do");
   if(b->dev != 1)
     panic("iderw: request not for disk 1");
-  if(b->blockno >= disksize)
+  if(b->blockno + (b->pages ? b->nblk : 1) > disksize)
     panic("iderw: block out of range");
 
   p = memdisk + b->blockno*BSIZE;
 
-  if(b->flags & B_DIRTY){
+  if(b->pages){
+    // Swap I/O: nblk blocks, BPP to a page.
+    for(i = b->boff; i < b->boff + b->nblk; i++, p += BSIZE){
+      q = (uchar*)b->pages[i/BPP] + (i%BPP)*BSIZE;
+      if(b->flags & B_DIRTY)
+        memmove(p, q, BSIZE);
+      else
+        memmove(q, p, BSIZE);
+    }
+    b->flags &= ~B_DIRTY;
+  } else if(b->flags & B_DIRTY){
     b->flags &= ~B_DIRTY;
     memmove(p, b->data, BSIZE);
   } else
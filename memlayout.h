@@ -1,12 +1,17 @@
 // Memory layout
 
 #define EXTMEM  0x100000            // Start of extended memory
-#define PHYSTOP 0x400000           // Top physical memory
+#define PHYSMAX 0x10000000          // Most physical memory the kernel uses
 #define DEVSPACE 0xFE000000         // Other devices are at high addresses
+#define E820MAP 0x500               // BIOS memory map, left by bootasm.S
 
 // Key addresses for address space layout (see kmap in vm.c for layout)
 #define KERNBASE 0x80000000         // First kernel virtual address
 #define KERNLINK (KERNBASE+EXTMEM)  // Address where kernel is linked
+#define USTACKTOP KERNBASE          // User stack grows down from here,
+#define USTACKSIZE 0x100000         // to at most this size
+#define STACKGAP 0x10000            // Unmapped guard gap below the stack
+#define MMAPTOP  (USTACKTOP-USTACKSIZE-STACKGAP) // mmap() regions lie below this
 
 #define V2P(a) (((uint) (a)) - KERNBASE)
 #define P2V(a) (((void *) (a)) + KERNBASE)
@@ -0,0 +1,13 @@
+// mmap() and mprotect() flags.
+// Both the kernel and user programs use this header file.
+
+#define PROT_NONE    0x0
+#define PROT_READ    0x1
+#define PROT_WRITE   0x2
+
+#define MAP_SHARED   0x01  // changes go to the file, seen by all
+#define MAP_PRIVATE  0x02  // changes are the process's own
+#define MAP_FIXED    0x10  // map exactly at addr
+#define MAP_ANON     0x20  // zero-filled memory, not a file
+
+#define MAP_FAILED   ((void*)-1)
@@ -0,0 +1,17 @@
+// Out-of-memory killer.
+// Both the kernel and user programs use this header file.
+
+#define OOM_ADJ_MIN  -1000  // never kill this process
+#define OOM_ADJ_MAX   1000  // kill this process first
+#define NOOMLOG         16  // events kept by the kernel
+
+// One kill by the OOM killer, as returned by oomlog().
+struct oomevent {
+  uint ticks;     // Time of the kill
+  int pid;        // Victim's process ID
+  char name[16];  // Victim's name
+  uint rss;       // Resident pages when killed
+  uint swap;      // Swapped-out pages when killed
+  int adj;        // Victim's oomadj
+  int score;      // Badness score that selected it
+};
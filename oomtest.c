@@ -0,0 +1,61 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "oom.h"
+
+#define NHOG 3
+
+// Touch one byte per page until the kernel kills us.
+void
+hog(void)
+{
+  char *p;
+
+  for(;;){
+    if((p = sbrk(4096)) == (char*)-1)
+      exit();
+    *p = 1;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct oomevent ev[NOOMLOG];
+  int i, n, pid, pids[NHOG];
+
+  printf(1, "oom test\n");
+  // Protect ourselves; the last hog is the preferred victim.
+  oomadj(getpid(), OOM_ADJ_MIN);
+  for(i = 0; i < NHOG; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      oomadj(getpid(), i == NHOG-1 ? OOM_ADJ_MAX : 0);
+      hog();
+    }
+    pids[i] = pid;
+  }
+
+  // Wait for the first victim, then stop the other hogs.
+  pid = wait();
+  for(i = 0; i < NHOG; i++)
+    if(pids[i] != pid)
+      kill(pids[i]);
+  for(i = 1; i < NHOG; i++)
+    wait();
+
+  n = oomlog(ev, NOOMLOG);
+  for(i = 0; i < n; i++)
+    printf(1, "oom: pid %d %s score %d rss %d swap %d adj %d\n",
+           ev[i].pid, ev[i].name, ev[i].score, ev[i].rss, ev[i].swap, ev[i].adj);
+  if(n == 0 || ev[n-1].pid != pids[NHOG-1]){
+    printf(1, "oom test failed\n");
+    exit();
+  }
+  printf(1, "oom test ok\n");
+  exit();
+}
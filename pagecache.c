@@ -0,0 +1,299 @@
+// File page cache.
+//
+// The data of regular files is cached here a page at a time,
+// one copy per inode and page-aligned offset, in frames from
+// kalloc().  readi() and writei() copy to and from these pages
+// and mmap() maps them, so reads, writes and mappings of a
+// file all see the same data.  The buffer cache (bio.c) is left
+// to the metadata: pages are read from the disk around it, and
+// writei() passes the blocks it writes through it only for the
+// log.
+//
+// A page's ref counts the PTEs that map it, which have PTE_F
+// set, and the readi() or writei() copying it.  Writes through
+// a shared mapping set PTE_D, and the page is written back to
+// the file (by writei(), through bmap()) when such a PTE goes
+// away: so a page nobody maps is always clean.  Unused pages
+// stay cached, least recently used first on the LRU list, until
+// memory runs short and reclaim() calls pcreclaim(), or their
+// file is truncated (pcdrop()).  An inode stays cached while it
+// has pages here, and pcreclaim() frees it with the last one.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "paging.h"
+#include "kmem.h"
+
+#define NPCHASH 127
+#define PCHASH(ip, off) ((((uint)(ip) >> 5) + ((off) >> PGSHIFT)) % NPCHASH)
+
+struct cpage {
+  struct inode *ip;
+  uint off;              // file offset, page-aligned
+  char *data;
+  int ref;               // PTEs mapping the page
+  struct cpage *hnext;   // hash chain
+  struct cpage *inext;   // ip->pages
+  struct cpage *lnext;   // LRU list, if ref is 0
+  struct cpage *lprev;
+};
+
+static struct {
+  struct spinlock lock;
+  struct slabcache *cache;
+  struct cpage *hash[NPCHASH];
+  struct cpage *lru;     // unmapped pages, oldest first
+  struct cpage *lrutail;
+  struct cpage **frame;  // page caching each physical page
+} pcache;
+
+// Must run after kinit2().
+void
+pcinit(void)
+{
+  int order;
+
+  initlock(&pcache.lock, "pcache");
+  pcache.cache = slabcreate("cpage", sizeof(struct cpage), 0);
+  for(order = 0; (PGSIZE << order) < phystop/PGSIZE * sizeof(*pcache.frame); order++)
+    ;
+  if((pcache.frame = (struct cpage**)kallocpages(order)) == 0)
+    panic("pcinit");
+  memset(pcache.frame, 0, PGSIZE << order);
+}
+
+static struct cpage*
+lookup(struct inode *ip, uint off)
+{
+  struct cpage *c;
+
+  for(c = pcache.hash[PCHASH(ip, off)]; c; c = c->hnext)
+    if(c->ip == ip && c->off == off)
+      return c;
+  return 0;
+}
+
+static void
+lruremove(struct cpage *c)
+{
+  if(c->lprev)
+    c->lprev->lnext = c->lnext;
+  else
+    pcache.lru = c->lnext;
+  if(c->lnext)
+    c->lnext->lprev = c->lprev;
+  else
+    pcache.lrutail = c->lprev;
+}
+
+static void
+lruadd(struct cpage *c)
+{
+  c->lnext = 0;
+  c->lprev = pcache.lrutail;
+  if(c->lprev)
+    c->lprev->lnext = c;
+  else
+    pcache.lru = c;
+  pcache.lrutail = c;
+}
+
+// Take a reference to c.  Caller holds pcache.lock.
+static void
+hold(struct cpage *c)
+{
+  if(c->ref++ == 0)
+    lruremove(c);
+}
+
+// Take c out of the cache.  Caller holds pcache.lock; c's
+// frame and c itself are then the caller's to free.
+static void
+evict(struct cpage *c)
+{
+  struct cpage **pp;
+
+  for(pp = &pcache.hash[PCHASH(c->ip, c->off)]; *pp != c; pp = &(*pp)->hnext)
+    ;
+  *pp = c->hnext;
+  for(pp = &c->ip->pages; *pp != c; pp = &(*pp)->inext)
+    ;
+  *pp = c->inext;
+  pcache.frame[V2P(c->data)/PGSIZE] = 0;
+  vmstat.filepages--;
+}
+
+// Look up the page of ip at off with a reference taken, or 0.
+static char*
+find(struct inode *ip, uint off)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  if((c = lookup(ip, off)) != 0)
+    hold(c);
+  release(&pcache.lock);
+  if(c == 0)
+    return 0;
+  vmstat.filehit++;
+  return c->data;
+}
+
+// Return the page of regular file ip at file offset off, which
+// must be page-aligned, with a reference taken, adding it if it
+// is not cached: read in if read is set, else zeroed, for the
+// caller to overwrite.  Bytes past the end of the file read as
+// zero.  Caller must hold ip->lock, which keeps others from
+// adding the page too.  Returns 0 if out of memory.
+char*
+pcpage(struct inode *ip, uint off, int read)
+{
+  struct cpage *c;
+  char *mem;
+
+  if((mem = find(ip, off)) != 0)
+    return mem;
+  if((mem = allocpage(!read)) == 0)
+    return 0;
+  if((c = slaballoc(pcache.cache)) == 0){
+    kfree(mem);
+    return 0;
+  }
+  if(read){
+    ireadpage(ip, mem, off);
+    vmstat.fileread++;
+  }
+  c->ip = ip;
+  c->off = off;
+  c->data = mem;
+  c->ref = 1;
+  acquire(&pcache.lock);
+  c->hnext = pcache.hash[PCHASH(ip, off)];
+  pcache.hash[PCHASH(ip, off)] = c;
+  c->inext = ip->pages;
+  ip->pages = c;
+  pcache.frame[V2P(mem)/PGSIZE] = c;
+  vmstat.filepages++;
+  release(&pcache.lock);
+  return mem;
+}
+
+// Return the page of ip at off, as pcpage() does, for a new
+// mapping of it.  Returns 0 if ip has become a swap file.
+char*
+pcget(struct inode *ip, uint off)
+{
+  char *mem;
+
+  if((mem = find(ip, off)) != 0)
+    return mem;
+  ilock(ip);
+  mem = ip->swap ? 0 : pcpage(ip, off, 1);
+  iunlock(ip);
+  return mem;
+}
+
+// Take another reference to page pg of the cache.
+void
+pcdup(char *pg)
+{
+  acquire(&pcache.lock);
+  pcache.frame[V2P(pg)/PGSIZE]->ref++;
+  release(&pcache.lock);
+}
+
+// Drop a reference to page pg of the cache, writing it back
+// first if the mapping going away dirtied it.  May sleep if
+// dirty is set.
+void
+pcput(char *pg, int dirty)
+{
+  struct cpage *c;
+  struct inode *ip;
+  uint n;
+
+  acquire(&pcache.lock);
+  c = pcache.frame[V2P(pg)/PGSIZE];
+  release(&pcache.lock);
+  if(c == 0)
+    panic("pcput");
+
+  // The reference still held keeps c and its inode.
+  if(dirty){
+    ip = c->ip;
+    begin_op();
+    ilock(ip);
+    if(c->off < ip->size){
+      n = ip->size - c->off;
+      writei(ip, c->data, c->off, n < PGSIZE ? n : PGSIZE);
+    }
+    iunlock(ip);
+    end_op();
+    vmstat.filewrite++;
+  }
+
+  acquire(&pcache.lock);
+  if(--c->ref == 0)
+    lruadd(c);
+  release(&pcache.lock);
+}
+
+// Free the least recently used page, and its inode if that
+// was the last page of an inode nobody refers to.  Returns 0
+// if every page is in use.
+int
+pcreclaim(void)
+{
+  struct cpage *c;
+
+  // icache.lock comes first, so that the inode cannot be freed
+  // or revived between evicting its last page and iprune().
+  lockicache();
+  acquire(&pcache.lock);
+  if((c = pcache.lru) == 0){
+    release(&pcache.lock);
+    unlockicache();
+    return 0;
+  }
+  lruremove(c);
+  evict(c);
+  iprune(c->ip);
+  release(&pcache.lock);
+  unlockicache();
+  kfree(c->data);
+  slabfree(pcache.cache, c);
+  vmstat.filedrop++;
+  return 1;
+}
+
+// Free the cached pages of ip, whose data is going away or
+// is about to change behind the cache's back.  Returns -1,
+// freeing nothing, if a page is in use.  Caller holds ip->lock.
+int
+pcdrop(struct inode *ip)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  for(c = ip->pages; c; c = c->inext){
+    if(c->ref != 0){
+      release(&pcache.lock);
+      return -1;
+    }
+  }
+  while((c = ip->pages) != 0){
+    lruremove(c);
+    evict(c);
+    kfree(c->data);
+    slabfree(pcache.cache, c);
+  }
+  release(&pcache.lock);
+  return 0;
+}
@@ -0,0 +1,287 @@
+// Page replacement policies.
+//
+// When a page has to be swapped out, select_a_victim() in
+// paging.c asks the current policy to choose one among the
+// resident user pages of a page table.  A policy is a table
+// of operations (struct pagepolicy in paging.h):
+//
+//   select   choose the page to evict, or 0 if there is none
+//   harvest  fold the PTE_A bits of a page table into the
+//            policy's own state, clearing them
+//   fault    a user page was just mapped at physical address pa
+//   free     the user page at pa is leaving memory
+//
+// harvest is also called periodically, under memory pressure,
+// by agescan() in paging.c.
+//
+// The policy at boot is PAGEPOLICY (POLICY in the Makefile);
+// the pagepolicy system call switches policies at run time.
+//
+// The per-frame state is updated without a lock: a lost
+// update only makes a victim choice slightly worse.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "paging.h"
+
+// A page that may be evicted: resident, and not a page of a
+// file that must be written back first.
+#define RESIDENT(pte) (((pte) & (PTE_P|PTE_U)) == (PTE_P|PTE_U) && \
+                       ((pte) & (PTE_F|PTE_D)) != (PTE_F|PTE_D))
+#define FRAME(pte)    (PTE_ADDR(pte) / PGSIZE)
+
+static struct frame {
+  uint stamp;  // FIFO: value of nextstamp when mapped
+  uchar age;   // aging: PTE_A history, most recent in the top bit
+  uchar gen;   // gen: scans since last seen accessed, up to NGEN-1
+} *frames;     // one per physical page, up to phystop
+
+static uint nextstamp;
+
+// Return the resident user page of pgdir with the smallest key,
+// the first one found if several share it.
+static pte_t*
+minpage(pde_t *pgdir, uint (*key)(pte_t))
+{
+  pte_t *pgtab, *victim;
+  uint k, min;
+  int i, j;
+
+  victim = 0;
+  min = 0;
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(!PDE_PGTAB(pgdir[i]))
+      continue;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++){
+      if(!RESIDENT(pgtab[j]))
+        continue;
+      k = key(pgtab[j]);
+      if(victim == 0 || k < min){
+        victim = &pgtab[j];
+        min = k;
+        if(k == 0)
+          return victim;
+      }
+    }
+  }
+  return victim;
+}
+
+static void
+nop(uint pa)
+{
+}
+
+static void
+noharvest(pde_t *pgdir)
+{
+}
+
+// FIFO: evict the page that has been resident longest,
+// however often it is used.
+
+static uint
+fifo_key(pte_t pte)
+{
+  return frames[FRAME(pte)].stamp - nextstamp;  // oldest is smallest
+}
+
+static pte_t*
+fifo_select(pde_t *pgdir)
+{
+  return minpage(pgdir, fifo_key);
+}
+
+static void
+fifo_fault(uint pa)
+{
+  frames[pa/PGSIZE].stamp = nextstamp++;
+}
+
+// CLOCK (second chance): sweep the pages in address order,
+// clearing PTE_A, and evict the first page found with PTE_A
+// already clear.  The hand stays where the last sweep stopped.
+// Victims are only chosen among the current process's pages,
+// so each process has its own hand (p->clockhand), and only
+// it moves it.
+
+static pte_t*
+clock_select(pde_t *pgdir)
+{
+  struct proc *p = myproc();
+  pte_t *pgtab, *pte;
+  int i, j, n;
+
+  i = PDX(p->clockhand) % PDX(KERNBASE);
+  j = PTX(p->clockhand);
+  // Two revolutions are enough: the first clears every PTE_A.
+  for(n = 0; n < 2*PDX(KERNBASE); n++){
+    if(PDE_PGTAB(pgdir[i])){
+      pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+      for(; j < NPTENTRIES; j++){
+        pte = &pgtab[j];
+        if(!RESIDENT(*pte))
+          continue;
+        if(*pte & PTE_A){
+          *pte &= ~PTE_A;
+          continue;
+        }
+        p->clockhand = PGADDR(i, j+1, 0);
+        return pte;
+      }
+    }
+    i = (i + 1) % PDX(KERNBASE);
+    j = 0;
+  }
+  p->clockhand = PGADDR(i, j, 0);
+  return 0;
+}
+
+// Aging (LRU approximation): every harvest shifts each page's
+// age right and puts its PTE_A bit in the top bit, so the page
+// with the smallest age is the one least recently used.
+
+static void
+aging_harvest(pde_t *pgdir)
+{
+  pte_t *pgtab;
+  uchar *age;
+  int i, j;
+
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(!PDE_PGTAB(pgdir[i]))
+      continue;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++){
+      if(!RESIDENT(pgtab[j]))
+        continue;
+      age = &frames[FRAME(pgtab[j])].age;
+      *age >>= 1;
+      if(pgtab[j] & PTE_A){
+        *age |= 0x80;
+        pgtab[j] &= ~PTE_A;
+      }
+    }
+  }
+}
+
+static uint
+aging_key(pte_t pte)
+{
+  return frames[FRAME(pte)].age;
+}
+
+static pte_t*
+aging_select(pde_t *pgdir)
+{
+  aging_harvest(pgdir);
+  return minpage(pgdir, aging_key);
+}
+
+static void
+aging_fault(uint pa)
+{
+  frames[pa/PGSIZE].age = 0x80;
+}
+
+static void
+aging_free(uint pa)
+{
+  frames[pa/PGSIZE].age = 0;
+}
+
+// Multi-generational: each harvest moves a page to generation 0
+// if it was accessed since the last one, and one generation
+// older otherwise.  Reclaim evicts from the oldest generation
+// first.  Unlike aging, selecting a victim does not harvest:
+// the generations are only as fresh as the periodic scan
+// makes them, which keeps eviction cheap.
+
+#define NGEN 4
+
+static void
+gen_harvest(pde_t *pgdir)
+{
+  pte_t *pgtab;
+  uchar *gen;
+  int i, j;
+
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(!PDE_PGTAB(pgdir[i]))
+      continue;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++){
+      if(!RESIDENT(pgtab[j]))
+        continue;
+      gen = &frames[FRAME(pgtab[j])].gen;
+      if(pgtab[j] & PTE_A){
+        *gen = 0;
+        pgtab[j] &= ~PTE_A;
+      } else if(*gen < NGEN-1)
+        (*gen)++;
+    }
+  }
+}
+
+static uint
+gen_key(pte_t pte)
+{
+  return NGEN-1 - frames[FRAME(pte)].gen;  // oldest is smallest
+}
+
+static pte_t*
+gen_select(pde_t *pgdir)
+{
+  return minpage(pgdir, gen_key);
+}
+
+static void
+gen_fault(uint pa)
+{
+  frames[pa/PGSIZE].gen = 0;
+}
+
+static struct pagepolicy policies[] = {
+[PP_FIFO]   { "fifo",  fifo_select,  noharvest,     fifo_fault,  nop },
+[PP_CLOCK]  { "clock", clock_select, noharvest,     nop,         nop },
+[PP_AGING]  { "aging", aging_select, aging_harvest, aging_fault, aging_free },
+[PP_GEN]    { "gen",   gen_select,   gen_harvest,   gen_fault,   nop },
+};
+
+struct pagepolicy *pagepolicy = &policies[PAGEPOLICY];
+
+// Allocate the per-frame state.  Must run after kinit2().
+void
+policyinit(void)
+{
+  int order;
+
+  for(order = 0; (PGSIZE << order) < phystop/PGSIZE * sizeof(*frames); order++)
+    ;
+  if((frames = (struct frame*)kallocpages(order)) == 0)
+    panic("policyinit");
+  memset(frames, 0, PGSIZE << order);
+}
+
+// Switch to policy id, returning the previous policy's id.
+// An id of -1 only returns the current one.
+int
+setpagepolicy(int id)
+{
+  int old;
+
+  old = pagepolicy - policies;
+  if(id == -1)
+    return old;
+  if(id < 0 || id >= NELEM(policies))
+    return -1;
+  if(id != old)
+    cprintf("pagepolicy: %s -> %s\n", pagepolicy->name, policies[id].name);
+  pagepolicy = &policies[id];
+  return old;
+}
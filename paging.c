@@ -1,3 +1,24 @@
+// Demand paging and swapping of user memory.
+//
+// growproc() only moves p->sz; user pages are allocated on
+// first touch by the page fault handler.  When physical memory
+// runs out, a page of the faulting process is written to a
+// swap slot (see swap.c) and its PTE is turned into a swap
+// entry: PTE_P clear, PTE_S set, the slot number in the
+// address bits and the original permission bits kept, so the
+// page can be restored as it was.
+//
+// fork() does not copy swapped-out pages: the child's PTE
+// refers to the same swap slot, which is reference counted.
+//
+// Reclaim swaps out a cluster of virtually adjacent pages at
+// once, to a run of consecutive slots written with a single
+// disk request where possible: page-out is sequential, and so
+// is paging the cluster back in (see fault_in).
+//
+// When neither free memory nor swap space is left, oomkill()
+// in proc.c chooses a process to kill.
+
 #include "types.h"
 #include "defs.h"
 #include "param.h"
@@ -8,8 +29,10 @@
 #include "traps.h"
 #include "spinlock.h"
 #include "paging.h"
-#include "fs.h"
+#include "kmem.h"
+#include "mman.h"
 
+struct vmstat vmstat;  // updated without a lock: only statistics
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
@@ -21,13 +44,14 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return 0;  // a 4 MB page has no page table
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -38,117 +62,631 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 
 // Select a page-table entry which is mapped
 // but not accessed. Notice that the user memory
-// is mapped between 0...KERNBASE.
+// is mapped between 0...KERNBASE.  The choice is
+// up to the current replacement policy.
+// Returns 0 if pgdir has no resident user page.
 pte_t*
 select_a_victim(pde_t *pgdir)
 {
-	// cprintf("SELECT A VICTIM");
-	for(;;) {
-		for(int i = 0; i < NPDENTRIES; i++) {
-			if( pgdir[i] & ~(PTE_A) ) {
-				return (pte_t*)P2V(PTE_ADDR(pgdir[i]));
-			}
-		}
-		clearaccessbit(pgdir);		
-	}
-	return 0;
+  return pagepolicy->select(pgdir);
 }
 
-// return the disk block-id, if the virtual address
+// return the swap slot, if the virtual address
 // was swapped, -1 otherwise.
 int
 getswappedblk(pde_t *pgdir, uint va)
 {
-	// cprintf("GET SWAPPED BLK");
-	pte_t *potential = walkpgdir(pgdir, (char*)va, 0);
-	if( *potential & ~(PTE_P) ) {
-		// in swap
-		return PTE_ADDR(*potential);
-	}
-	else {
-  		return -1;
-	}
-}
-
+  pte_t *pte;
 
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_S))
+    return PTE_SWAPSLOT(*pte);
+  return -1;
+}
 
-// Clear access bit of a random pte.
+// Hand the access bits of pgdir's pages to the current
+// replacement policy, which clears them.
 void
 clearaccessbit(pde_t *pgdir)
 {
-	// cprintf("CLEAR ACCESS BIT");
-	int random_no = 10 % NPDENTRIES;
-	pde_t *pde = &pgdir[random_no];
-	pte_t *random_pte = (pte_t*)P2V(PTE_ADDR(*pde));
-	*random_pte &= ~(PTE_A); 
+  pagepolicy->harvest(pgdir);
+}
+
+// Count the resident and the swapped-out user pages of pgdir.
+void
+uvmusage(pde_t *pgdir, uint *rss, uint *swp)
+{
+  pte_t *pgtab;
+  int i, j;
+
+  *rss = *swp = 0;
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(pgdir[i] & PTE_PS)
+      *rss += NPTENTRIES;
+    if(!PDE_PGTAB(pgdir[i]))
+      continue;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++){
+      if(pgtab[j] & PTE_P)
+        (*rss)++;
+      else if(pgtab[j] & PTE_S)
+        (*swp)++;
+    }
+  }
+}
+
+/* Save the contents of the n resident pages mapped at va in
+ * pgdir, which lie in one page table, to a run of consecutive
+ * swap slots, in that order, and save the slot numbers into
+ * their ptes.  If no run of n slots is free, only the first
+ * n/2, n/4, ... pages are swapped out.
+ * Returns the number of pages swapped out, 0 if the swap
+ * space is full.
+ */
+int
+swap_pages(pde_t *pgdir, uint va, int n)
+{
+  char *pages[NSWAPOUT];
+  pte_t *pte;
+  uint slot;
+  int i;
+
+  if(n > NSWAPOUT || PDX(va) != PDX(va + (n-1)*PGSIZE))
+    panic("swap_pages");
+  if((pte = uva2pte(pgdir, va)) == 0)
+    panic("swap_pages: no pgtab");
+  while((slot = swapalloc(n)) == 0)
+    if((n /= 2) == 0)
+      return 0;
+
+  // The pages must stay put while they are written out.
+  for(i = 0; i < n; i++){
+    pages[i] = P2V(PTE_ADDR(pte[i]));
+    rmapclear(V2P(pages[i]));
+  }
+  swapwrite(pages, n, slot);
+  for(i = 0; i < n; i++)
+    pte[i] = ((slot + i) << PGSHIFT) |
+             (PTE_FLAGS(pte[i]) & ~(PTE_P|PTE_A|PTE_D)) | PTE_S;
+  // No CPU may use the pages once they are freed.
+  tlbflush(pgdir, va, n);
+  for(i = 0; i < n; i++){
+    pagepolicy->free(V2P(pages[i]));
+    kfree(pages[i]);
+  }
+  return n;
 }
 
-/* Allocate eight consecutive disk blocks.
- * Save the content of the physical page in the pte
- * to the disk blocks and save the block-id into the
- * pte.
+/* Swap out the page at va in pgdir.
+ * Returns -1 if the swap space is full.
  */
+int
+swap_page_at(pde_t *pgdir, uint va)
+{
+  return swap_pages(pgdir, va, 1) == 1 ? 0 : -1;
+}
+
+// A resident user page not accessed since its PTE_A bit
+// was last cleared.
+#define COLD(pte) (((pte) & (PTE_P|PTE_U|PTE_A|PTE_F)) == (PTE_P|PTE_U))
+
+//PAGEBREAK: 40
+// Transparent superpages.  User pages are first mapped one
+// 4 KB page at a time.  Once every page of a 4 MB-aligned
+// part of the user address space that lies wholly within one
+// anonymous region is resident and has the region's
+// protection, the pages are copied into one 4 MB page
+// (PTE_PS) if the buddy allocator has, or compaction can
+// make, a free 4 MB block and memory is not short.  The
+// region's memory is then in use already, so promotion does
+// not commit memory the process has not touched.
+// Large heaps then take one page directory entry and one TLB
+// entry per 4 MB.  A superpage is split into 4 KB pages when
+// part of it is unmapped, when fork cannot copy it whole, and
+// when reclaim finds nothing else to swap out.
+
+// Is every page of page table pgtab resident, anonymous and
+// mapped with permissions perm?  Checks from the top down, so
+// that a region being filled in from the bottom fails fast.
+static int
+populated(pte_t *pgtab, uint perm)
+{
+  int j;
+
+  for(j = NPTENTRIES-1; j >= 0; j--)
+    if((pgtab[j] & (PTE_P|PTE_W|PTE_U|PTE_S|PTE_F)) != (PTE_P|perm))
+      return 0;
+  return 1;
+}
+
+// Replace the 4 KB pages around user address va, in region
+// v, with one superpage if they are all populated.
+// Returns 0 if it did.
+int
+promotesuper(pde_t *pgdir, struct vma *v, uint va)
+{
+  uint base, pa;
+  pte_t *pgtab;
+  char *mem;
+  int j;
+
+  base = va & ~(SPGSIZE-1);
+  if(base < v->start || base + SPGSIZE > v->end || vmaperm(v) == 0 ||
+     !PDE_PGTAB(pgdir[PDX(base)]))
+    return -1;
+  pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[PDX(base)]));
+  if(!populated(pgtab, vmaperm(v)) || lowmem())
+    return -1;
+  if((mem = kallocpages(MAXORDER)) == 0 &&
+     (!compact() || (mem = kallocpages(MAXORDER)) == 0)){
+    vmstat.superfail++;
+    return -1;
+  }
+  // Compaction may have moved or reclaimed some of the pages.
+  if(!populated(pgtab, vmaperm(v))){
+    kfreepages(mem, MAXORDER);
+    return -1;
+  }
+  for(j = 0; j < NPTENTRIES; j++)
+    memmove(mem + j*PGSIZE, P2V(PTE_ADDR(pgtab[j])), PGSIZE);
+  pgdir[PDX(base)] = V2P(mem) | PTE_PS | vmaperm(v) | PTE_P;
+  tlbflush(pgdir, base, NPTENTRIES);
+  for(j = 0; j < NPTENTRIES; j++){
+    pa = PTE_ADDR(pgtab[j]);
+    pagepolicy->free(pa);
+    rmapclear(pa);
+    kfree(P2V(pa));
+  }
+  kfree((char*)pgtab);
+  vmstat.nsuper++;
+  vmstat.superalloc++;
+  return 0;
+}
+
+// Give pgdir a copy of the superpage of src at va, if a free
+// 4 MB block can be had.  Returns 0 if it did.
+int
+copysuper(pde_t *d, pde_t *src, uint va)
+{
+  char *mem;
+
+  if((mem = kallocpages(MAXORDER)) == 0){
+    vmstat.superfail++;
+    return -1;
+  }
+  memmove(mem, P2V(PTE_ADDR(src[PDX(va)])), SPGSIZE);
+  d[PDX(va)] = V2P(mem) | PTE_FLAGS(src[PDX(va)]);
+  vmstat.nsuper++;
+  vmstat.superalloc++;
+  return 0;
+}
+
+// Map the frames of the superpage at va with 4 KB pages
+// instead, using page pg as the page table if pg is not 0.
+// pg may be one of the superpage's own frames that is being
+// unmapped: it is then left out of the page table.
+// Returns -1 if out of memory.
+int
+splitsuper(pde_t *pgdir, uint va, char *pg)
+{
+  pde_t *pde;
+  pte_t *pgtab;
+  uint pa, flags;
+  int j;
+
+  pde = &pgdir[PDX(va)];
+  if(!(*pde & PTE_PS))
+    return 0;
+  if((pgtab = (pte_t*)pg) == 0 && (pgtab = (pte_t*)kalloc()) == 0)
+    return -1;
+  pa = PTE_ADDR(*pde);
+  flags = PTE_FLAGS(*pde) & ~PTE_PS;
+  for(j = 0; j < NPTENTRIES; j++, pa += PGSIZE){
+    if(pa == V2P(pgtab)){
+      pgtab[j] = 0;
+      continue;
+    }
+    pgtab[j] = pa | flags;
+    pagepolicy->fault(pa);
+    rmapset(pa, pgdir, PGADDR(PDX(va), j, 0));
+  }
+  *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+  tlbflush(pgdir, va & ~(SPGSIZE-1), NPTENTRIES);
+  vmstat.nsuper--;
+  vmstat.supersplit++;
+  return 0;
+}
+
+// Split some superpage of pgdir.  Returns 0 if there was none,
+// or no memory for its page table.
+static int
+splitany(pde_t *pgdir)
+{
+  int i;
+
+  for(i = 0; i < PDX(KERNBASE); i++)
+    if(pgdir[i] & PTE_PS)
+      return splitsuper(pgdir, PGADDR(i, 0, 0), 0) == 0;
+  return 0;
+}
+
+// Unmap and free the whole superpage at va.
 void
-swap_page_from_pte(pte_t *pte)
+freesuper(pde_t *pgdir, uint va)
 {
-	uint addr = balloc_page(ROOTDEV);
-	uint ppn = PTE_ADDR(*pte);	
-	char *pg = (char *)P2V(ppn);
-	asm volatile("invlpg (%0)" ::"r" ((unsigned long)P2V(ppn)) : "memory");
-	write_page_to_disk(ROOTDEV, pg, addr);
-	*pte &= ~(PTE_P);
-	*pte = addr; ///> Check if it makes sense -> reserve some bit? WHAT?
-	kfree(pg);
+  kfreepages(P2V(PTE_ADDR(pgdir[PDX(va)])), MAXORDER);
+  pgdir[PDX(va)] = 0;
+  vmstat.nsuper--;
 }
 
-/* Select a victim and swap the contents to the disk.
+/* Select a victim and swap it out together with up to
+ * NSWAPOUT-1 of its cold neighbours in the same page table,
+ * which are likely to be wanted back at the same time.
+ * A victim mapping a page of a file is just unmapped.
+ * Returns 0 if nothing could be swapped out.
  */
 pte_t*
 swap_page(pde_t *pgdir)
 {
-	// cprintf("SWAP PAGE");
-	pte_t *victim = select_a_victim(pgdir);
-	swap_page_from_pte(victim);
-	// panic("swap_page is not implemented");
-	return victim;
+  pte_t *victim, *pgtab;
+  int pdx, lo, hi;
+  char *pg;
+
+  if((victim = select_a_victim(pgdir)) == 0){
+    // Superpages cannot be swapped out; split one into pages
+    // that can.
+    if(!splitany(pgdir) || (victim = select_a_victim(pgdir)) == 0)
+      return 0;
+  }
+  pgtab = (pte_t*)PGROUNDDOWN((uint)victim);
+  lo = hi = victim - pgtab;
+  for(pdx = 0; pdx < PDX(KERNBASE); pdx++)
+    if(PDE_PGTAB(pgdir[pdx]) && P2V(PTE_ADDR(pgdir[pdx])) == (char*)pgtab)
+      break;
+  if(pdx == PDX(KERNBASE))
+    panic("swap_page");
+  if(*victim & PTE_F){
+    // A clean page of a file: just unmap it, and free it if
+    // no one else maps it.
+    pg = P2V(PTE_ADDR(*victim));
+    *victim = 0;
+    tlbflush(pgdir, PGADDR(pdx, lo, 0), 1);
+    pcput(pg, 0);
+    pcreclaim();
+    return victim;
+  }
+  while(hi - lo + 1 < NSWAPOUT){
+    if(hi + 1 < NPTENTRIES && COLD(pgtab[hi+1]))
+      hi++;
+    else if(lo > 0 && COLD(pgtab[lo-1]))
+      lo--;
+    else
+      break;
+  }
+  if(swap_pages(pgdir, PGADDR(pdx, lo, 0), hi - lo + 1) == 0)
+    return 0;
+  return victim;
+}
+
+// Make a physical page available, by swapping out a page of
+// the current process or, if that is impossible, by letting
+// the OOM killer free memory.  Returns 0 if no progress can
+// be made and the caller's allocation should fail.
+static int
+reclaim(void)
+{
+  struct proc *curproc = myproc();
+
+  if(curproc == 0 || curproc->killed)
+    return 0;
+  if(pcreclaim() || swap_page(curproc->pgdir) != 0)
+    return 1;
+  // Waiting for a victim to exit with a transaction open
+  // could wait for ever: its exit needs the log too.
+  return oomkill(curproc->nop == 0);
+}
+
+// Allocate one page of physical memory for user memory,
+// zeroed if zero is set, reclaiming memory if none is free.
+// Returns 0 if the memory cannot be allocated.
+char*
+allocpage(int zero)
+{
+  char *mem;
+
+  while((mem = zero ? kzalloc() : kalloc()) == 0)
+    if(!reclaim())
+      return 0;
+  return mem;
 }
 
 /* Map a physical page to the virtual address addr.
- * If the page table entry points to a swapped block
- * restore the content of the page from the swapped
- * block and free the swapped block.
+ * If the page table entry points to a swap slot
+ * restore the content of the page from the slot
+ * and drop our reference to the slot; otherwise map
+ * a zeroed page with permissions perm.
+ * Returns -1 if out of memory.
  */
-void
-map_address(pde_t *pgdir, uint addr)
+int
+map_address(pde_t *pgdir, uint addr, uint perm)
+{
+  pte_t *pte, old;
+  char *mem;
+  uint slot;
+
+  while((pte = walkpgdir(pgdir, (char*)addr, 1)) == 0)
+    if(!reclaim())
+      return -1;
+  // swapoff() may page a swapped-out page in while this
+  // process sleeps: hold the slot, and check the PTE after.
+  old = *pte;
+  slot = PTE_SWAPSLOT(old);
+  if(old & PTE_S)
+    swapdup(slot);
+  if((mem = allocpage(!(old & PTE_S))) == 0){
+    if(old & PTE_S)
+      swapfree(slot);
+    return -1;
+  }
+
+  // The page is about to be used: mark it accessed, so that
+  // it is not the next victim.
+  if(old & PTE_S){
+    swapread(mem, slot);
+    swapfree(slot);
+    if(*pte != old){
+      kfree(mem);
+      return 0;
+    }
+    swapfree(slot);
+    *pte = V2P(mem) | (PTE_FLAGS(old) & ~PTE_S) | PTE_P | PTE_A;
+  } else {
+    *pte = V2P(mem) | perm | PTE_P | PTE_A;
+  }
+  pagepolicy->fault(V2P(mem));
+  rmapset(V2P(mem), pgdir, addr);
+  if(myproc() && myproc()->pgdir == pgdir)
+    myproc()->nfault++;
+  return 0;
+}
+
+/* Map page pg of the file page cache at the virtual address
+ * addr with permissions perm, or a private copy of it if copy
+ * is set, in place of whatever is mapped there.  The caller's
+ * reference to pg passes to the mapping, or is dropped for a
+ * copy.  Returns -1 if out of memory.
+ */
+int
+map_cached(pde_t *pgdir, uint addr, char *pg, uint perm, int copy)
+{
+  pte_t *pte;
+  char *mem;
+
+  mem = 0;
+  while((pte = walkpgdir(pgdir, (char*)addr, 1)) == 0)
+    if(!reclaim())
+      goto bad;
+  if(copy){
+    if((mem = allocpage(0)) == 0)
+      goto bad;
+    memmove(mem, pg, PGSIZE);
+    pcput(pg, 0);
+    pg = mem;
+  }
+  // Only a page of the file can be mapped here already.
+  if(*pte & PTE_P){
+    *pte &= ~PTE_P;
+    tlbflush(pgdir, addr, 1);
+    pcput(P2V(PTE_ADDR(*pte)), 0);
+  }
+  if(copy){
+    *pte = V2P(mem) | perm | PTE_P | PTE_A;
+    rmapset(V2P(mem), pgdir, addr);
+  } else
+    *pte = V2P(pg) | perm | PTE_F | PTE_P | PTE_A;
+  pagepolicy->fault(V2P(pg));
+  if(myproc() && myproc()->pgdir == pgdir)
+    myproc()->nfault++;
+  return 0;
+
+bad:
+  pcput(pg, 0);
+  return -1;
+}
+
+/* Map page mem, which the caller has filled in, at the virtual
+ * address addr with permissions perm.  Returns -1, freeing
+ * mem, if out of memory.
+ */
+int
+map_filled(pde_t *pgdir, uint addr, char *mem, uint perm)
 {
-	// cprintf("MAP ADDRESS");
-	pte_t *target;
-	// int swap_blk;
+  pte_t *pte;
+
+  while((pte = walkpgdir(pgdir, (char*)addr, 1)) == 0){
+    if(!reclaim()){
+      kfree(mem);
+      return -1;
+    }
+  }
+  *pte = V2P(mem) | perm | PTE_P | PTE_A;
+  pagepolicy->fault(V2P(mem));
+  rmapset(V2P(mem), pgdir, addr);
+  if(myproc() && myproc()->pgdir == pgdir)
+    myproc()->nfault++;
+  return 0;
+}
+
+#define NFAULTIN 16  // swapped pages fault_in() reads per sweep
 
-	if( (target = walkpgdir(pgdir, (char *)addr, 1)) == 0 ) {
-		target = swap_page(pgdir);
-	} //Recheck for round down !!!
-	uint ppn = PTE_ADDR(*target);	
-	char *pg = (char *)P2V(ppn);
+/* Make the user pages of pgdir covering [va, va+len) resident,
+ * so that the kernel can copy to and from them without taking
+ * a page fault, which it may not do holding a spinlock and
+ * cannot recover from if memory runs out.  Swapped-out pages
+ * are gathered and read back in swap slot order, so that the
+ * disk is swept once per batch instead of seeking back and
+ * forth.  Missing pages in a region of p, if p is not 0, are
+ * filled in as a page fault would; other missing pages are an
+ * error.  If write is set the pages must be writable, and
+ * private copies of file pages are made now.  Returns -1 on
+ * error or if out of memory.
+ */
+int
+fault_in(pde_t *pgdir, struct proc *p, uint va, uint len, int write)
+{
+  uint a, last, t, vas[NFAULTIN], blks[NFAULTIN];
+  int i, j, n;
+  struct vma *v;
+  pte_t *pte;
 
-	// if((swap_blk = getswappedblk(pgdir, addr)) != -1){
-	if( (*target & ~(PTE_P)) ){
-		read_page_from_disk(ROOTDEV, pg, *target);
-		bfree_page(ROOTDEV, *target);
-	}
+  if(len == 0)
+    return 0;
+  if(va + len < va || va + len > KERNBASE)
+    return -1;
+  a = PGROUNDDOWN(va);
+  last = PGROUNDDOWN(va + len - 1);
+  for(;;){
+    // Zero-fill missing pages and gather a batch of swapped ones.
+    n = 0;
+    for(; a <= last && n < NFAULTIN; a += PGSIZE){
+      if(pgdir[PDX(a)] & PTE_PS){
+        if(!(pgdir[PDX(a)] & PTE_U) || (write && !(pgdir[PDX(a)] & PTE_W)))
+          return -1;
+        continue;  // superpages are always resident
+      }
+      pte = walkpgdir(pgdir, (char*)a, 0);
+      if(pte && (*pte & (PTE_P|PTE_S))){
+        if(!(*pte & PTE_U))
+          return -1;
+        if(write && !(*pte & PTE_W) && !(*pte & PTE_F))
+          return -1;
+      }
+      if(pte && (*pte & PTE_P) && (!write || (*pte & PTE_W)))
+        continue;
+      if(pte && (*pte & PTE_S)){
+        // Insertion sort by swap slot.
+        t = PTE_SWAPSLOT(*pte);
+        for(j = n; j > 0 && blks[j-1] > t; j--){
+          blks[j] = blks[j-1];
+          vas[j] = vas[j-1];
+        }
+        blks[j] = t;
+        vas[j] = a;
+        n++;
+        continue;
+      }
+      // Missing, or a page of a file about to be written.
+      if(p == 0 || (v = findvma(p, a)) == 0 || vmaperm(v) == 0 ||
+         (write && !(v->prot & PROT_WRITE)) || vmafault(p, v, a, write) < 0)
+        return -1;
+    }
+    for(i = 0; i < n; i++){
+      // Faulting in one page may have swapped out another.
+      pte = walkpgdir(pgdir, (char*)vas[i], 0);
+      if(!(*pte & PTE_P) && map_address(pgdir, vas[i], 0) < 0)
+        return -1;
+    }
+    if(a > last)
+      return 0;
+  }
+}
 
-	// panic("map_address is not implemented");
+// Is memory short?  True once less than a quarter of
+// the pages are free; reclaim is then not far off.
+int
+lowmem(void)
+{
+  return kfreecnt() < ktotalcnt()/4;
 }
 
-/* page fault handler */
+// Count the resident user pages of pgdir with PTE_A set.
+static uint
+naccessed(pde_t *pgdir)
+{
+  pte_t *pgtab;
+  uint n;
+  int i, j;
+
+  n = 0;
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(!PDE_PGTAB(pgdir[i]))
+      continue;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++)
+      if((pgtab[j] & (PTE_P|PTE_U|PTE_A)) == (PTE_P|PTE_U|PTE_A))
+        n++;
+  }
+  return n;
+}
+
+#define SCANIVL 32  // ticks between scans when memory just got tight
+
+// Called on timer ticks taken in user mode.  Harvests the
+// access bits of the running process's pages into the
+// replacement policy.  Scans run more often the less memory
+// is free, from every SCANIVL ticks down to every tick, and
+// not at all while memory is not short.
+//
+// Each scan also updates the process's working set estimate:
+// the pages it used since the last scan, whether still
+// resident (PTE_A) or faulted in and evicted again since.
 void
-handle_pgfault()
+agescan(void)
 {
-	// cprintf("HANDLE PGFAULT");
-	unsigned addr;
-	struct proc *curproc = myproc();
+  struct proc *p = myproc();
+  int high;
+  uint ivl;
 
-	asm volatile ("movl %%cr2, %0 \n\t" : "=r" (addr));
-	addr &= ~0xfff;
-	map_address(curproc->pgdir, addr);
+  if(!lowmem())
+    return;
+  high = ktotalcnt()/4;
+  ivl = 1 + SCANIVL*kfreecnt()/high;
+  if(ticks - p->lastscan < ivl)
+    return;
+  p->lastscan = ticks;
+  p->wss = (p->wss + naccessed(p->pgdir) + p->nfault) / 2;
+  p->nfault = 0;
+  clearaccessbit(p->pgdir);
+}
+
+/* page fault handler.  Returns -1 if the fault was not
+ * caused by a valid access to the user address space.
+ */
+int
+handle_pgfault(struct trapframe *tf)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+  uint addr;
+  pte_t *pte;
+  int write;
+
+  addr = PGROUNDDOWN(rcr2());
+  write = tf->err & FEC_WR;
+  if(curproc == 0 || (v = findvma(curproc, addr)) == 0)
+    return -1;
+  // An access the region's protection forbids.
+  if(vmaperm(v) == 0 || (write && !(v->prot & PROT_WRITE)))
+    return -1;
+  // A protection fault on a resident page (e.g. the stack
+  // guard), unless it is a page of a file being written.
+  if(curproc->pgdir[PDX(addr)] & PTE_PS)
+    return -1;
+  pte = walkpgdir(curproc->pgdir, (char*)addr, 0);
+  if(pte && (*pte & PTE_P) && !(write && (*pte & PTE_F)))
+    return -1;
+
+  if(vmafault(curproc, v, addr, write) < 0){
+    // The kernel cannot resume the faulting instruction.
+    if((tf->cs&3) == 0)
+      return -1;
+    if(!curproc->killed)
+      cprintf("pid %d %s: out of memory at 0x%x--kill proc\n",
+              curproc->pid, curproc->name, addr);
+    curproc->killed = 1;
+    return 0;
+  }
+  if(v->f == 0 && !(v->flags & VMA_UF))
+    promotesuper(curproc->pgdir, v, addr);
+  return 0;
 }
@@ -1,13 +1,89 @@
 #ifndef PAGING_H
 #define PAGING_H
 
-void handle_pgfault();
+struct trapframe;
+struct proc;
+struct vma;
+
+// Swap slot of a swapped-out page (PTE_S set, PTE_P clear).
+#define PTE_SWAPSLOT(pte) ((uint)(pte) >> PGSHIFT)
+
+// Does a page directory entry point to a page table, rather
+// than map a 4 MB superpage (PTE_PS) or nothing?
+#define PDE_PGTAB(pde) (((pde) & (PTE_P|PTE_PS)) == PTE_P)
+
+// swap.c
+struct inode;
+struct swapstat;
+
+// A kind of block device swap areas can live on.
+struct swapbackend {
+  char *name;
+  // Transfer nblk blocks, the first being block first of
+  // pages, to or from the blocks of dev starting at blk.
+  void (*rw)(uint dev, char **pages, uint first, uint nblk, uint blk, int write);
+  uint (*size)(uint dev);  // blocks on dev, 0 if none
+};
+
+extern uint swapgen;
+void swapinit(void);
+int swapdev(int type, struct swapbackend *be, uint dev, int prio);
+uint swapalloc(int n);
+void swapwrite(char **pages, int n, uint slot);
+void swapread(char *pg, uint slot);
+void swapdup(uint slot);
+void swapfree(uint slot);
+void swapreserve(uint b, int n);
+int swapreserved(uint b);
+int swapon(struct inode *ip, int prio);
+int swapoff(struct inode *ip);
+void swapdrain(void);
+int swapstat(struct swapstat *st, int n);
+
+// Page replacement policies, see pagepolicy.c.
+#define PP_FIFO   0
+#define PP_CLOCK  1
+#define PP_AGING  2
+#define PP_GEN    3
+
+#ifndef PAGEPOLICY
+#define PAGEPOLICY PP_GEN
+#endif
+
+struct pagepolicy {
+  char *name;
+  pte_t* (*select)(pde_t *pgdir);  // choose a victim among pgdir's pages
+  void (*harvest)(pde_t *pgdir);   // take in and clear pgdir's PTE_A bits
+  void (*fault)(uint pa);          // user page mapped at pa
+  void (*free)(uint pa);           // user page at pa leaving memory
+};
+
+extern struct pagepolicy *pagepolicy;
+void policyinit(void);
+int setpagepolicy(int id);
+
+int handle_pgfault(struct trapframe *tf);
+void agescan(void);
+int lowmem(void);
 pte_t* select_a_victim(pde_t *pgdir);
 void clearaccessbit(pde_t *pgdir);
 int getswappedblk(pde_t *pgdir, uint va);
 pte_t* swap_page(pde_t *pgdir);
-void swap_page_from_pte(pte_t *pte);
-void map_address(pde_t *pgdir, uint addr);
+int swap_page_at(pde_t *pgdir, uint va);
+int swap_pages(pde_t *pgdir, uint va, int n);
+int map_address(pde_t *pgdir, uint addr, uint perm);
+int map_cached(pde_t *pgdir, uint addr, char *pg, uint perm, int copy);
+int map_filled(pde_t *pgdir, uint addr, char *mem, uint perm);
+int fault_in(pde_t *pgdir, struct proc *p, uint va, uint len, int write);
+char* allocpage(int zero);
+void uvmusage(pde_t *pgdir, uint *rss, uint *swp);
 pte_t *uva2pte(pde_t *pgdir, uint uva);
+int promotesuper(pde_t *pgdir, struct vma *v, uint va);
+int copysuper(pde_t *d, pde_t *pgdir, uint va);
+int splitsuper(pde_t *pgdir, uint va, char *pg);
+void freesuper(pde_t *pgdir, uint va);
+
+struct vmstat;
+extern struct vmstat vmstat;
 
 #endif
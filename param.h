@@ -2,8 +2,6 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
@@ -11,4 +9,15 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       128000  // size of file system in blocks
+#define NSWAPOUT     16  // pages reclaim writes to swap in one request
+#define NSWAPAREA    6   // swap areas: root file system, disks, RAM disk, files
+#define NDISK        4   // IDE disks: two channels of two drives
+#define NZEROPAGE    64  // zeroed free pages idle CPUs keep ready
+#define KMAGSIZE     16  // free pages a CPU keeps for itself
+#define NSLABCACHE    8  // slab caches
+#define SLABMAG       8  // objects of each slab cache a CPU keeps
+#define NVMA         16  // memory regions per process
+#ifndef RAMSWAP
+#define RAMSWAP      0   // pages of RAM disk to swap to (see Makefile)
+#endif
 
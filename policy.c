@@ -0,0 +1,27 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Must match the PP_ numbers in paging.h.
+char *names[] = { "fifo", "clock", "aging", "gen" };
+
+int
+main(int argc, char *argv[])
+{
+  int i, old;
+
+  if(argc < 2){
+    printf(1, "%s\n", names[pagepolicy(-1)]);
+    exit();
+  }
+  for(i = 0; i < sizeof(names)/sizeof(names[0]); i++)
+    if(strcmp(argv[1], names[i]) == 0)
+      break;
+  if(i == sizeof(names)/sizeof(names[0])){
+    printf(2, "usage: policy [fifo|clock|aging|gen]\n");
+    exit();
+  }
+  old = pagepolicy(i);
+  printf(1, "%s -> %s\n", names[old], names[i]);
+  exit();
+}
@@ -7,6 +7,7 @@
 #include "proc.h"
 #include "spinlock.h"
 #include "paging.h"
+#include "oom.h"
 
 struct {
   struct spinlock lock;
@@ -15,6 +16,13 @@ struct {
 
 static struct proc *initproc;
 
+// Kills by the OOM killer, most recent last.
+// Protected by ptable.lock.
+static struct {
+  struct oomevent ev[NOOMLOG];
+  uint n;                       // number of kills so far
+} oom;
+
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
@@ -89,6 +97,15 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->oomadj = 0;
+  p->lastscan = 0;
+  p->nfault = 0;
+  p->wss = 0;
+  p->admitted = 0;
+  p->swapgen = 0;
+  p->uf = 0;
+  p->kpreempt = 0;
+  p->clockhand = 0;
 
   release(&ptable.lock);
 
@@ -131,6 +148,7 @@ userinit(void)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
   p->sz = PGSIZE;
+  vmainit(p, p->sz);
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -159,14 +177,45 @@ userinit(void)
 int
 growproc(int n)
 {
+  uint sz;
   struct proc *curproc = myproc();
 
-  if (n < 0 || n > KERNBASE || curproc->sz + n > KERNBASE)
-	  return -1;
-  curproc->sz += n;
+  // Growing only moves sz: pages are allocated on first touch.
+  sz = curproc->sz;
+  if(n > 0){
+    if(n > KERNBASE || sz + n > KERNBASE || vmaheap(curproc, sz + n) < 0)
+      return -1;
+    sz += n;
+  } else if(n < 0){
+    if((uint)-n > sz)
+      return -1;
+    sz = deallocuvm(curproc->pgdir, sz, sz + n);
+    // Flush the freed pages from the TLBs.
+    tlbflush(curproc->pgdir, PGROUNDUP(sz),
+             (PGROUNDUP(curproc->sz) - PGROUNDUP(sz)) / PGSIZE);
+    vmaheap(curproc, sz);
+  }
+  curproc->sz = sz;
   return 0;
 }
 
+// Install a new page table and size for p, returning the old
+// page table.  Done under ptable.lock so that oomkill() never
+// walks a page table that exec() is about to free.
+pde_t*
+setuvm(struct proc *p, pde_t *pgdir, uint sz)
+{
+  pde_t *old;
+
+  acquire(&ptable.lock);
+  old = p->pgdir;
+  p->pgdir = pgdir;
+  p->sz = sz;
+  vmainit(p, sz);
+  release(&ptable.lock);
+  return old;
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -183,14 +232,16 @@ fork(void)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+  if((np->pgdir = copyuvm(curproc->pgdir, USTACKTOP)) == 0){
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
     return -1;
   }
   np->sz = curproc->sz;
+  vmadup(np, curproc);
   np->parent = curproc;
+  np->oomadj = curproc->oomadj;
   *np->tf = *curproc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
@@ -240,11 +291,23 @@ exit(void)
   end_op();
   curproc->cwd = 0;
 
+  // Give back user memory now rather than in wait(), so that
+  // it is available at once if the OOM killer chose us.
+  vmaclear(curproc);
+  ufdetach(curproc);
+  deallocuvm(curproc->pgdir, MMAPTOP, 0);
+
   acquire(&ptable.lock);
 
+  curproc->sz = 0;
+  curproc->nvma = 0;
+
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
 
+  // oomkill() might be waiting for memory.
+  wakeup1(&oom);
+
   // Pass abandoned children to init.
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->parent == curproc){
@@ -308,6 +371,51 @@ wait(void)
   }
 }
 
+#define WSQUANTUM 100  // ticks a memory-heavy process keeps its admission
+
+// Thrashing control.  While memory is short, a process whose
+// working set estimate (p->wss, see agescan) is a sixteenth of
+// memory or more only runs once admitted, and processes are
+// admitted only while the working sets of the admitted ones
+// fit in three quarters of memory.  The others wait their turn
+// instead of stealing each other's pages.  An admission lasts
+// WSQUANTUM ticks, much longer than a time slice, so that a
+// working set that was paged in gets used before it is paged
+// out again.  A sleeping process's pages stay resident, so its
+// working set counts too, but only until its admission runs
+// out, so that a deferred process holding something an
+// admitted one waits for gets to run in the end.
+// Called with ptable.lock held.
+static int
+admit(struct proc *p)
+{
+  struct proc *q;
+  uint load;
+
+  if(!lowmem() || p->killed || p->wss < ktotalcnt()/16){
+    p->admitted = 0;
+    return 1;
+  }
+  if(p->admitted){
+    if(ticks - p->admitstart < WSQUANTUM)
+      return 1;
+    // Rotate: processes further on in the table get a chance
+    // before p is considered again.
+    p->admitted = 0;
+    return 0;
+  }
+  load = 0;
+  for(q = ptable.proc; q < &ptable.proc[NPROC]; q++)
+    if(q->admitted && q->state != UNUSED && q->state != ZOMBIE &&
+       ticks - q->admitstart < WSQUANTUM)
+      load += q->wss;
+  if(load > 0 && load + p->wss > ktotalcnt()*3/4)
+    return 0;
+  p->admitted = 1;
+  p->admitstart = ticks;
+  return 1;
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -321,6 +429,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int ran;
   c->proc = 0;
   
   for(;;){
@@ -328,9 +437,10 @@ scheduler(void)
     sti();
 
     // Loop over process table looking for process to run.
+    ran = 0;
     acquire(&ptable.lock);
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
+      if(p->state != RUNNABLE || !admit(p))
         continue;
 
       // Switch to chosen process.  It is the process's job
@@ -339,9 +449,11 @@ scheduler(void)
       c->proc = p;
       switchuvm(p);
       p->state = RUNNING;
+      ran = 1;
 
       swtch(&(c->scheduler), p->context);
       switchkvm();
+      c->pgdir = 0;
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
@@ -349,6 +461,10 @@ scheduler(void)
     }
     release(&ptable.lock);
 
+    // Nothing to run: zero a free page for kzalloc(), or
+    // else compact memory a little, meanwhile.
+    if(!ran && !kzfill())
+      compactidle();
   }
 }
 
@@ -493,6 +609,190 @@ kill(int pid)
   return -1;
 }
 
+//PAGEBREAK: 40
+// Out-of-memory killer.  When a page can be obtained neither
+// from free memory nor by swapping one out, oomkill() picks
+// the process with the highest badness score, kills it, and
+// waits for it to give back its memory.
+
+// Badness of p: its resident plus swapped-out pages, biased
+// by p->oomadj thousandths of physical memory.
+static int
+badness(struct proc *p, uint *rss, uint *swp)
+{
+  int points;
+
+  uvmusage(p->pgdir, rss, swp);
+  points = *rss + *swp + p->oomadj * ktotalcnt() / 1000;
+  return points > 0 ? points : 1;
+}
+
+// Compaction (compact.c) moves the pages of processes that
+// are not running, holding ptable.lock so that they stay so.
+void
+lockptable(void)
+{
+  acquire(&ptable.lock);
+}
+
+void
+unlockptable(void)
+{
+  release(&ptable.lock);
+}
+
+// Is p stopped where another CPU may change its page table:
+// sleeping, or runnable but not preempted in the kernel, which
+// may have been in the middle of reading a PTE?  Sleeping code
+// that reads a PTE checks it again on waking.
+static int
+stopped(struct proc *p)
+{
+  return p->state == SLEEPING || (p->state == RUNNABLE && !p->kpreempt);
+}
+
+// Is pgdir the page table of a stopped process, which no CPU
+// has loaded?  Caller holds ptable.lock.
+int
+pgdirstopped(pde_t *pgdir)
+{
+  struct proc *p;
+
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->pgdir == pgdir)
+      return stopped(p);
+  return 0;
+}
+
+// The page table of the process in slot i of the process
+// table, if it is stopped (see pgdirstopped), else 0.
+// Caller holds ptable.lock.
+pde_t*
+procpgdir(int i)
+{
+  struct proc *p;
+
+  p = &ptable.proc[i];
+  return stopped(p) ? p->pgdir : 0;
+}
+
+// Kill a process to free memory.  Returns 1 once memory may
+// have been freed and the caller should retry its allocation,
+// or 0 if the caller should give up: either it was chosen
+// itself or there is nothing left that may be killed.  If
+// !canwait, the caller gives up rather than wait for a victim.
+int
+oomkill(int canwait)
+{
+  struct proc *p, *victim;
+  struct proc *curproc = myproc();
+  struct oomevent *e;
+  uint rss, swp, vrss, vswp;
+  int points, vpoints;
+
+  acquire(&ptable.lock);
+
+  // A process killed earlier may still be on its way out;
+  // wait for it rather than killing another.
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p != curproc && p->killed && p->sz > 0 &&
+       (p->state == SLEEPING || p->state == RUNNABLE || p->state == RUNNING))
+      goto wait;
+
+  victim = 0;
+  vpoints = vrss = vswp = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p == initproc || p->killed || p->oomadj == OOM_ADJ_MIN)
+      continue;
+    if(p->state != SLEEPING && p->state != RUNNABLE && p->state != RUNNING)
+      continue;
+    points = badness(p, &rss, &swp);
+    if(points > vpoints){
+      victim = p;
+      vpoints = points;
+      vrss = rss;
+      vswp = swp;
+    }
+  }
+  if(victim == 0){
+    release(&ptable.lock);
+    return 0;
+  }
+
+  e = &oom.ev[oom.n++ % NOOMLOG];
+  e->ticks = ticks;
+  e->pid = victim->pid;
+  safestrcpy(e->name, victim->name, sizeof(e->name));
+  e->rss = vrss;
+  e->swap = vswp;
+  e->adj = victim->oomadj;
+  e->score = vpoints;
+  cprintf("oom: killed pid %d %s score %d rss %d swap %d\n",
+          victim->pid, victim->name, vpoints, vrss, vswp);
+
+  victim->killed = 1;
+  if(victim->state == SLEEPING)
+    victim->state = RUNNABLE;
+  if(victim == curproc){
+    release(&ptable.lock);
+    return 0;
+  }
+
+wait:
+  if(!canwait){
+    release(&ptable.lock);
+    return 0;
+  }
+  sleep(&oom, &ptable.lock);
+  release(&ptable.lock);
+  return 1;
+}
+
+// Set the OOM badness bias of process pid.
+// Returns the previous value, or -1 if there is no such process.
+int
+oomadj(int pid, int adj)
+{
+  struct proc *p;
+  int old;
+
+  if(adj < OOM_ADJ_MIN)
+    adj = OOM_ADJ_MIN;
+  if(adj > OOM_ADJ_MAX)
+    adj = OOM_ADJ_MAX;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED){
+      old = p->oomadj;
+      p->oomadj = adj;
+      release(&ptable.lock);
+      return old;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Copy up to n of the most recent OOM kills, oldest first, to ev.
+// Returns the number of events copied.
+int
+oomlog(struct oomevent *ev, int n)
+{
+  uint i, first;
+
+  acquire(&ptable.lock);
+  first = 0;
+  if(oom.n > NOOMLOG)
+    first = oom.n - NOOMLOG;
+  if(oom.n - first > n)
+    first = oom.n - n;
+  for(i = first; i < oom.n; i++)
+    ev[i - first] = oom.ev[i % NOOMLOG];
+  n = oom.n - first;
+  release(&ptable.lock);
+  return n;
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -520,7 +820,8 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
+    cprintf("%d %s %s wss %d%s", p->pid, state, p->name, p->wss,
+            p->admitted ? " admitted" : "");
     if(p->state == SLEEPING){
       getcallerpcs((uint*)p->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
@@ -8,6 +8,7 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  pde_t *pgdir;                // User page table loaded, or null (tlb.c)
 };
 
 extern struct cpu cpus[NCPU];
@@ -32,6 +33,20 @@ struct context {
   uint eip;
 };
 
+// A region of the user address space: the pages in it may be
+// touched, with protection prot, and are zero-filled or read
+// from file f on demand.
+struct vma {
+  uint start;                  // First address, page-aligned
+  uint end;                    // One past the last
+  int prot;                    // PROT_READ, PROT_WRITE (mman.h)
+  int flags;                   // MAP_ flags, 0 for the heap
+  struct file *f;              // Mapped file, or 0
+  uint off;                    // Offset in f of start
+};
+
+#define VMA_UF 0x1000          // flags: faults go to p->uf (userfault.c)
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -49,10 +64,25 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  int oomadj;                  // OOM badness bias, OOM_ADJ_MIN..OOM_ADJ_MAX
+  uint lastscan;               // ticks at last access bit harvest (agescan)
+  uint nfault;                 // pages faulted in since lastscan
+  uint wss;                    // working set estimate, in pages
+  int admitted;                // may run while memory is short (admit)
+  uint admitstart;             // ticks when admitted
+  uint swapgen;                // swapgen when last drained (swapdrain)
+  struct vma vma[NVMA];        // Memory regions, sorted by address (vma.c)
+  int nvma;                    // Number of regions in use
+  struct userfault *uf;        // Handles faults in VMA_UF regions, or 0
+  int nop;                     // FS operations begun and not ended (log.c)
+  int kpreempt;                // Preempted in the kernel (trap)
+  uint clockhand;              // Where the CLOCK policy looks next (pagepolicy.c)
 };
 
-// Process memory is laid out contiguously, low addresses first:
-//   text
-//   original data and bss
-//   fixed-size stack
-//   expandable heap
+// Process memory is laid out in regions, low addresses first:
+//   text, original data and bss, and the expandable heap:
+//     the first region, vma[0], [0, sz)
+//   regions made by mmap(), handed out downwards from MMAPTOP
+//   an unmapped guard gap, STACKGAP bytes
+//   the stack, growing down from USTACKTOP by up to USTACKSIZE:
+//     the last region
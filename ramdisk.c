@@ -0,0 +1,72 @@
+// RAM disk for swap, in the style of memide.c: a swap area
+// whose blocks are pages of physical memory set aside at
+// boot, RAMSWAP of them (see the Makefile).  Swapping to it
+// is fast and takes the same time every run, which is what
+// comparing paging policies needs, and with memory to spare
+// it serves as a fast tier in front of disk swap.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "fs.h"
+#include "paging.h"
+#include "swap.h"
+
+static struct {
+  char **pg;    // the disk's pages
+  uint npage;
+} ramdisk;
+
+static uint
+ramdisksize(uint dev)
+{
+  return ramdisk.npage * BPP;
+}
+
+static void
+ramdiskrw(uint dev, char **pages, uint first, uint nblk, uint blk, int write)
+{
+  char *p, *q;
+  uint i, n;
+
+  if(blk + nblk > ramdisk.npage * BPP)
+    panic("ramdiskrw");
+  // As many blocks at a time as stay within a page on
+  // both sides: whole pages when both are aligned.
+  for(i = 0; i < nblk; i += n, blk += n){
+    n = BPP - blk%BPP;
+    if(n > BPP - (first+i)%BPP)
+      n = BPP - (first+i)%BPP;
+    if(n > nblk - i)
+      n = nblk - i;
+    p = ramdisk.pg[blk/BPP] + (blk%BPP)*BSIZE;
+    q = pages[(first+i)/BPP] + ((first+i)%BPP)*BSIZE;
+    if(write)
+      memmove(p, q, n*BSIZE);
+    else
+      memmove(q, p, n*BSIZE);
+  }
+}
+
+static struct swapbackend rambackend = { "ram", ramdiskrw, ramdisksize };
+
+// Set aside RAMSWAP pages, at most a page's worth of
+// pointers, and swap to them.  Must run after kinit2().
+void
+ramdiskinit(void)
+{
+  uint n;
+
+  n = RAMSWAP;
+  if(n == 0)
+    return;
+  if(n > PGSIZE/sizeof(char*))
+    n = PGSIZE/sizeof(char*);
+  if((ramdisk.pg = (char**)kalloc()) == 0)
+    panic("ramdiskinit");
+  for(ramdisk.npage = 0; ramdisk.npage < n; ramdisk.npage++)
+    if((ramdisk.pg[ramdisk.npage] = kalloc()) == 0)
+      break;
+  swapdev(SWAP_RAM, &rambackend, 0, SWAP_PRIORAM);
+}
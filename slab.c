@@ -0,0 +1,252 @@
+// Slab allocator for small kernel objects.
+//
+// A cache hands out objects of one size.  It carves them out
+// of slabs: pages from kalloc() that begin with a struct slab
+// and hold as many objects as fit after it.  A slab's page
+// goes back to kalloc() as soon as none of its objects is in
+// use.
+//
+// Each CPU keeps a magazine of up to SLABMAG objects of each
+// cache, so most slaballoc() and slabfree() calls take no
+// lock.  An empty magazine is refilled, and a full one
+// drained, SLABMAG/2 objects at a time, as kalloc.c does for
+// pages.
+//
+// A cache's constructor, if it has one, runs on each object
+// once, when its slab is made, not on every slaballoc(): so
+// objects must be freed in their constructed state (with
+// their locks released, for example).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "kmem.h"
+
+struct slab {
+  struct slab *next;     // on the cache's partial list
+  struct slab *prev;
+  char *free;            // first free object
+  int inuse;             // objects not free
+};
+
+struct slabcache {
+  struct spinlock lock;
+  char *name;
+  uint size;             // object size
+  uint stride;           // size plus the free-list link, rounded up
+  int perslab;           // objects in a slab
+  void (*ctor)(void*);
+  struct slab *partial;  // slabs with free objects
+  uint nslab;
+  uint inuse;            // objects out of the slabs
+  struct {
+    void *obj[SLABMAG];
+    int n;
+    uint alloc;
+    uint free;
+    uint hit;            // slaballoc()s the magazine served alone
+  } cpu[NCPU];
+};
+
+static struct {
+  struct spinlock lock;
+  struct slabcache cache[NSLABCACHE];
+  int n;
+} slabs;
+
+// A free object's link to the next one is kept after it,
+// not in it, so as not to undo the constructor's work.
+#define LINK(c, o)  (*(char**)((char*)(o) + (c)->size))
+
+void
+slabinit(void)
+{
+  initlock(&slabs.lock, "slabs");
+}
+
+// Create a cache of objects of size bytes, run through ctor
+// (if not 0) when their slab is made.
+struct slabcache*
+slabcreate(char *name, uint size, void (*ctor)(void*))
+{
+  struct slabcache *c;
+
+  acquire(&slabs.lock);
+  if(slabs.n == NSLABCACHE)
+    panic("slabcreate: too many caches");
+  c = &slabs.cache[slabs.n++];
+  release(&slabs.lock);
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = (size + 3) & ~3;
+  c->stride = c->size + sizeof(char*);
+  c->perslab = (PGSIZE - sizeof(struct slab)) / c->stride;
+  if(c->perslab < 1)
+    panic("slabcreate: object too big");
+  c->ctor = ctor;
+  return c;
+}
+
+static void
+unlink(struct slabcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+static void
+push(struct slabcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+// Make a new slab for c.  Caller holds c->lock.
+static struct slab*
+grow(struct slabcache *c)
+{
+  struct slab *s;
+  char *o;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->free = 0;
+  s->inuse = 0;
+  o = (char*)(s + 1);
+  for(i = 0; i < c->perslab; i++, o += c->stride){
+    if(c->ctor)
+      c->ctor(o);
+    LINK(c, o) = s->free;
+    s->free = o;
+  }
+  push(c, s);
+  c->nslab++;
+  return s;
+}
+
+// Take an object out of a slab.  Caller holds c->lock.
+static void*
+take(struct slabcache *c)
+{
+  struct slab *s;
+  char *o;
+
+  if((s = c->partial) == 0 && (s = grow(c)) == 0)
+    return 0;
+  o = s->free;
+  s->free = LINK(c, o);
+  s->inuse++;
+  if(s->free == 0)
+    unlink(c, s);
+  c->inuse++;
+  return o;
+}
+
+// Put an object back in its slab, freeing the slab if it
+// becomes empty.  Caller holds c->lock.
+static void
+put(struct slabcache *c, char *o)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)o);
+  if(s->free == 0)
+    push(c, s);
+  LINK(c, o) = s->free;
+  s->free = o;
+  c->inuse--;
+  if(--s->inuse == 0){
+    unlink(c, s);
+    kfree((char*)s);
+    c->nslab--;
+  }
+}
+
+// Allocate an object from c.
+// Returns 0 if the memory cannot be allocated.
+void*
+slaballoc(struct slabcache *c)
+{
+  void *o;
+  int i;
+
+  pushcli();
+  i = cpuid();
+  c->cpu[i].alloc++;
+  if(c->cpu[i].n > 0)
+    c->cpu[i].hit++;
+  else {
+    acquire(&c->lock);
+    while(c->cpu[i].n < SLABMAG/2 && (o = take(c)) != 0)
+      c->cpu[i].obj[c->cpu[i].n++] = o;
+    release(&c->lock);
+  }
+  o = 0;
+  if(c->cpu[i].n > 0)
+    o = c->cpu[i].obj[--c->cpu[i].n];
+  popcli();
+  return o;
+}
+
+// Free an object returned by slaballoc(c).
+void
+slabfree(struct slabcache *c, void *o)
+{
+  int i, n;
+
+  pushcli();
+  i = cpuid();
+  c->cpu[i].free++;
+  if(c->cpu[i].n == SLABMAG){
+    acquire(&c->lock);
+    for(n = 0; n < SLABMAG/2; n++)
+      put(c, c->cpu[i].obj[--c->cpu[i].n]);
+    release(&c->lock);
+  }
+  c->cpu[i].obj[c->cpu[i].n++] = o;
+  popcli();
+}
+
+// Copy out the state of up to n caches.
+int
+slabstat(struct slabstat *st, int n)
+{
+  struct slabcache *c;
+  int i, j;
+
+  acquire(&slabs.lock);
+  if(n > slabs.n)
+    n = slabs.n;
+  release(&slabs.lock);
+  for(i = 0; i < n; i++){
+    c = &slabs.cache[i];
+    memset(&st[i], 0, sizeof(st[i]));
+    safestrcpy(st[i].name, c->name, sizeof(st[i].name));
+    acquire(&c->lock);
+    st[i].size = c->size;
+    st[i].perslab = c->perslab;
+    st[i].nslab = c->nslab;
+    st[i].inuse = c->inuse;
+    release(&c->lock);
+    for(j = 0; j < NCPU; j++){
+      st[i].cached += c->cpu[j].n;
+      st[i].alloc += c->cpu[j].alloc;
+      st[i].free += c->cpu[j].free;
+      st[i].hit += c->cpu[j].hit;
+    }
+    st[i].inuse -= st[i].cached;
+  }
+  return n;
+}
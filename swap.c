@@ -0,0 +1,565 @@
+// Swap space.
+//
+// A swapped-out page occupies a swap slot of BPP (eight)
+// blocks.  Its PTE keeps the slot's number (PTE_SWAPSLOT):
+// the swap area in the top bits, the slot's index within the
+// area in the rest.
+//
+// Area 0 is always there: free blocks of the root file
+// system, slot i being blocks i*BPP to i*BPP+7.  balloc_pages
+// finds them in the free map but does not mark them there:
+// they are only reserved in memory (rootref), which balloc
+// honours.  So allocating and freeing a slot never takes a
+// transaction, and may be done from inside one (a page cache
+// read reclaiming memory), and a crash leaks nothing.
+// It is only used when no other area has room.
+//
+// The other areas are whole disks on the second IDE channel,
+// found at boot, a RAM disk (ramdisk.c) if one is configured,
+// and preallocated regular files added by swapon().  Each
+// does its I/O through a backend (struct swapbackend).  A
+// file's block map is resolved once into an extent table, so
+// swap I/O never walks indirect blocks or locks the inode.
+// Slots of these areas are allocated from reference counts
+// kept in memory, without touching the file system.  Each
+// has a priority: slots come from the areas with the highest
+// priority that have room, taking turns among those of equal
+// priority, so that batches of pages are striped across them.
+//
+// swapoff() stops allocation from a file and pages back in
+// what is left in it: its caller's pages, then those of the
+// processes that are stopped (pgdirstopped), holding the slot
+// while reading it and mapping the page only if the PTE has
+// not changed meanwhile.  A process that was running pages
+// its own pages in the next time it returns to user space
+// (swapdrain).  The file is let go once none of its slots is
+// in use.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "paging.h"
+#include "swap.h"
+
+#define AREASHIFT 17
+#define SLOT(a, i)   (((a) << AREASHIFT) | (i))
+#define SLOTAREA(s)  ((s) >> AREASHIFT)
+#define SLOTIDX(s)   ((s) & ((1 << AREASHIFT) - 1))
+
+#define NAREASLOT PGSIZE  // most slots in a disk or file area
+
+struct swaparea {
+  int type;                // SWAP_*, or -1 if this area is unused
+  struct swapbackend *be;  // does the I/O
+  struct inode *ip;        // swap file
+  uint dev;
+  int prio;
+  uint nslot;
+  uint nused;
+  uint pgout, pgin;
+  uchar *ref;              // reference count of each slot
+  int draining;            // swapoff() called: no new slots
+  uint rotor;              // where to look for free slots next
+  int next;                // extents in ext, for a file
+  struct extent ext[MAXFILE];
+  uchar slotref[NAREASLOT];
+};
+
+struct {
+  struct spinlock lock;
+  struct swaparea area[NSWAPAREA];
+  int last;                // area slots last came from
+  uchar rootref[FSSIZE/BPP];
+} swap;
+
+extern int numallocblocks;  // fs.c
+
+uint swapgen;  // bumped when an area starts draining
+
+struct swapbackend idebackend = { "ide", swaprw, idesize };
+
+// Set up area 0, and an area for each disk on the second
+// IDE channel.  Must run after ideinit().
+void
+swapinit(void)
+{
+  struct swaparea *a;
+  uint dev;
+
+  initlock(&swap.lock, "swap");
+  for(a = swap.area; a < &swap.area[NSWAPAREA]; a++)
+    a->type = -1;
+  a = &swap.area[0];
+  a->type = SWAP_ROOT;
+  a->be = &idebackend;
+  a->dev = ROOTDEV;
+  a->prio = -1;
+  a->nslot = FSSIZE/BPP;
+  a->ref = swap.rootref;
+
+  for(dev = 2; dev < NDISK; dev++)
+    if(idesize(dev) > 0)
+      swapdev(SWAP_DISK, &idebackend, dev, SWAP_PRIODISK);
+}
+
+// Add the whole of device dev of backend be as a swap area
+// of the given type and priority.  Returns -1 if it is empty
+// or there is no free area.
+int
+swapdev(int type, struct swapbackend *be, uint dev, int prio)
+{
+  struct swaparea *a;
+  uint nslot;
+
+  if((nslot = be->size(dev) / BPP) == 0)
+    return -1;
+  if(nslot > NAREASLOT)
+    nslot = NAREASLOT;
+  acquire(&swap.lock);
+  for(a = swap.area; a < &swap.area[NSWAPAREA] && a->type >= 0; a++)
+    ;
+  if(a == &swap.area[NSWAPAREA]){
+    release(&swap.lock);
+    return -1;
+  }
+  a->type = type;
+  a->be = be;
+  a->dev = dev;
+  a->prio = prio;
+  a->nslot = nslot;
+  a->ref = a->slotref;
+  release(&swap.lock);
+  cprintf("swap: %s %d, %d pages, priority %d\n", be->name, dev, nslot, prio);
+  return 0;
+}
+
+// Return the disk block holding block b of area a, and set
+// *n to the number of blocks contiguous on disk from there.
+static uint
+areablock(struct swaparea *a, uint b, uint *n)
+{
+  struct extent *e;
+  int lo, hi, mid;
+
+  if(a->type != SWAP_FILE){  // identity
+    *n = ~0;
+    return b;
+  }
+  // The last extent starting at or before b.
+  lo = 0;
+  hi = a->next - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(a->ext[mid].fblk <= b)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  e = &a->ext[lo];
+  *n = e->fblk + e->len - b;
+  return e->dblk + b - e->fblk;
+}
+
+// Transfer n pages to or from the slots starting at slot,
+// with one disk request per extent they cross.
+static void
+slotrw(char **pages, int n, uint slot, int write)
+{
+  struct swaparea *a;
+  uint b, i, m, blk;
+
+  a = &swap.area[SLOTAREA(slot)];
+  b = SLOTIDX(slot)*BPP;
+  for(i = 0; i < n*BPP; i += m){
+    blk = areablock(a, b + i, &m);
+    if(m > n*BPP - i)
+      m = n*BPP - i;
+    a->be->rw(a->dev, pages, i, m, blk, write);
+  }
+}
+
+// Write n pages to the n slots starting at slot.
+void
+swapwrite(char **pages, int n, uint slot)
+{
+  slotrw(pages, n, slot, 1);
+  acquire(&swap.lock);
+  swap.area[SLOTAREA(slot)].pgout += n;
+  release(&swap.lock);
+}
+
+// Read the page in slot into pg.
+void
+swapread(char *pg, uint slot)
+{
+  slotrw(&pg, 1, slot, 0);
+  acquire(&swap.lock);
+  swap.area[SLOTAREA(slot)].pgin++;
+  release(&swap.lock);
+}
+
+// Return the first of n free consecutive slots of disk or
+// file area a, or -1.  Caller must hold swap.lock.
+static int
+findrun(struct swaparea *a, int n)
+{
+  uint i, k;
+  int run;
+
+  run = 0;
+  for(k = 0; k < a->nslot; k++){
+    i = (a->rotor + k) % a->nslot;
+    if(i == 0)
+      run = 0;
+    if(a->ref[i] != 0){
+      run = 0;
+      continue;
+    }
+    if(++run == n)
+      return i - n + 1;
+  }
+  return -1;
+}
+
+// Allocate n consecutive swap slots, from the area with the
+// highest priority that has room, the next one in turn after
+// the last used if several have the same.  Returns the first
+// slot, each with a reference count of 1, or 0 if there is
+// no such run.
+uint
+swapalloc(int n)
+{
+  struct swaparea *a, *best;
+  uint blk;
+  int i, k, first;
+
+  acquire(&swap.lock);
+  best = 0;
+  first = 0;
+  for(k = 1; k <= NSWAPAREA; k++){
+    a = &swap.area[(swap.last + k) % NSWAPAREA];
+    if(a->type < 0 || a->type == SWAP_ROOT)
+      continue;
+    if(a->draining || (best && a->prio <= best->prio))
+      continue;
+    if((i = findrun(a, n)) >= 0){
+      best = a;
+      first = i;
+    }
+  }
+  if(best){
+    for(k = 0; k < n; k++)
+      best->ref[first+k] = 1;
+    best->rotor = first + n;
+    best->nused += n;
+    swap.last = best - swap.area;
+    release(&swap.lock);
+    return SLOT(swap.last, first);
+  }
+  release(&swap.lock);
+
+  // The root file system.  Block 0 is never free, so
+  // neither is slot 0.
+  if((blk = balloc_pages(ROOTDEV, n)) == 0)
+    return 0;
+  return SLOT(0, blk/BPP);
+}
+
+// Reserve the n root file system slots starting at block
+// b, found free by balloc_pages.  Caller holds the free map
+// block's buffer, so balloc cannot take them meanwhile.
+void
+swapreserve(uint b, int n)
+{
+  int k;
+
+  acquire(&swap.lock);
+  for(k = 0; k < n; k++)
+    swap.rootref[b/BPP + k] = 1;
+  swap.area[0].nused += n;
+  numallocblocks += n*BPP;
+  release(&swap.lock);
+}
+
+// Is root file system block b, free in the free map, in
+// a reserved swap slot?
+int
+swapreserved(uint b)
+{
+  int r;
+
+  acquire(&swap.lock);
+  r = swap.rootref[b/BPP] != 0;
+  release(&swap.lock);
+  return r;
+}
+
+// Take another reference to slot, for a PTE copied by fork().
+void
+swapdup(uint slot)
+{
+  uchar *ref;
+
+  acquire(&swap.lock);
+  ref = &swap.area[SLOTAREA(slot)].ref[SLOTIDX(slot)];
+  if(*ref == 0 || *ref == 255)
+    panic("swapdup");
+  (*ref)++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot.  The last one frees it.
+void
+swapfree(uint slot)
+{
+  struct swaparea *a;
+
+  acquire(&swap.lock);
+  a = &swap.area[SLOTAREA(slot)];
+  if(a->ref[SLOTIDX(slot)] == 0)
+    panic("swapfree");
+  if(--a->ref[SLOTIDX(slot)] == 0){
+    a->nused--;
+    if(SLOTAREA(slot) == 0)
+      numallocblocks -= BPP;
+  }
+  release(&swap.lock);
+}
+
+// Return the PTE of the first page of pgdir at or above *va
+// that is swapped out to area, setting *va to its address,
+// or 0 if there is none.
+static pte_t*
+findslot(pde_t *pgdir, uint *va, int area)
+{
+  pte_t *pgtab;
+  uint a;
+
+  for(a = *va; a < KERNBASE; a += PGSIZE){
+    if(!PDE_PGTAB(pgdir[PDX(a)])){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[PDX(a)]));
+    if((pgtab[PTX(a)] & PTE_S) &&
+       SLOTAREA(PTE_SWAPSLOT(pgtab[PTX(a)])) == area){
+      *va = a;
+      return &pgtab[PTX(a)];
+    }
+  }
+  return 0;
+}
+
+// Page in the pages of stopped processes that are swapped
+// out to area.  Returns -1 if out of memory.
+static int
+swapinall(int area)
+{
+  pde_t *pgdir;
+  pte_t *pte, old;
+  char *mem;
+  uint va, slot;
+  int i;
+
+  for(i = 0; i < NPROC; i++){
+    for(va = 0; ; va += PGSIZE){
+      lockptable();
+      if((pgdir = procpgdir(i)) == 0 ||
+         (pte = findslot(pgdir, &va, area)) == 0){
+        unlockptable();
+        break;
+      }
+      old = *pte;
+      slot = PTE_SWAPSLOT(old);
+      swapdup(slot);
+      unlockptable();
+
+      if((mem = allocpage(0)) == 0){
+        swapfree(slot);
+        return -1;
+      }
+      swapread(mem, slot);
+
+      // The process may have run meanwhile.
+      lockptable();
+      if(procpgdir(i) == pgdir && (pte = uva2pte(pgdir, va)) != 0 &&
+         *pte == old){
+        *pte = V2P(mem) | (PTE_FLAGS(old) & ~PTE_S) | PTE_P;
+        pagepolicy->fault(V2P(mem));
+        rmapset(V2P(mem), pgdir, va);
+        swapfree(slot);
+        mem = 0;
+      }
+      unlockptable();
+      swapfree(slot);
+      if(mem)
+        kfree(mem);
+    }
+  }
+  return 0;
+}
+
+// Start swapping to the regular file ip, as many whole
+// pages of it as there are, with priority prio.  Caller must
+// hold ip->lock and give the area its reference to ip.
+int
+swapon(struct inode *ip, int prio)
+{
+  struct swaparea *a;
+  uint nslot;
+
+  if(ip->type != T_FILE || ip->swap || prio < 0)
+    return -1;
+  // Swap I/O goes around the page cache.
+  if(pcdrop(ip) < 0)
+    return -1;
+  if((nslot = ip->size / PGSIZE) == 0)
+    return -1;
+  if(nslot > NAREASLOT)
+    nslot = NAREASLOT;
+
+  acquire(&swap.lock);
+  for(a = swap.area; a < &swap.area[NSWAPAREA] && a->type >= 0; a++)
+    ;
+  if(a == &swap.area[NSWAPAREA]){
+    release(&swap.lock);
+    return -1;
+  }
+  a->type = SWAP_FILE;  // reserve it
+  a->be = &idebackend;
+  a->ip = ip;
+  a->draining = 1;      // but allocate nothing yet
+  a->nslot = 0;
+  release(&swap.lock);
+
+  if((a->next = iextents(ip, nslot*BPP, a->ext, NELEM(a->ext))) < 0){
+    acquire(&swap.lock);
+    a->type = -1;
+    release(&swap.lock);
+    return -1;
+  }
+  a->dev = ip->dev;
+  a->prio = prio;
+  a->nslot = nslot;
+  a->nused = a->pgout = a->pgin = 0;
+  a->ref = a->slotref;
+  memset(a->ref, 0, nslot);
+  a->rotor = 0;
+  ip->swap = 1;
+  acquire(&swap.lock);
+  a->draining = 0;
+  release(&swap.lock);
+  return 0;
+}
+
+// Stop swapping to the file ip.  Returns 0 once none of its
+// pages is left and the area has let go of it, giving its
+// reference to ip back to the caller.  Returns -1 if ip is
+// not a swap file or still holds pages: processes page those
+// back in as they return to user space, and the call can be
+// repeated.  Caller must hold ip->lock.
+int
+swapoff(struct inode *ip)
+{
+  struct swaparea *a;
+
+  acquire(&swap.lock);
+  for(a = swap.area; a < &swap.area[NSWAPAREA]; a++)
+    if(a->type == SWAP_FILE && a->ip == ip)
+      break;
+  if(a == &swap.area[NSWAPAREA] || !ip->swap){
+    release(&swap.lock);
+    return -1;
+  }
+  if(!a->draining){
+    a->draining = 1;
+    swapgen++;
+  }
+  release(&swap.lock);
+
+  swapdrain();
+  if(swapinall(a - swap.area) < 0)
+    return -1;
+
+  acquire(&swap.lock);
+  if(a->type != SWAP_FILE || a->ip != ip || a->nused > 0){
+    release(&swap.lock);
+    return -1;
+  }
+  a->type = -1;
+  a->ip = 0;
+  release(&swap.lock);
+  ip->swap = 0;
+  return 0;
+}
+
+// Copy out the state of up to n swap areas.
+// Returns the number copied.
+int
+swapstat(struct swapstat *st, int n)
+{
+  struct swaparea *a;
+  int i;
+
+  i = 0;
+  acquire(&swap.lock);
+  for(a = swap.area; a < &swap.area[NSWAPAREA] && i < n; a++){
+    if(a->type < 0 || a->nslot == 0)
+      continue;
+    st[i].area = a - swap.area;
+    st[i].type = a->type;
+    st[i].dev = a->dev;
+    st[i].inum = a->type == SWAP_FILE ? a->ip->inum : 0;
+    st[i].prio = a->prio;
+    st[i].draining = a->draining;
+    st[i].nslot = a->nslot;
+    st[i].nused = a->nused;
+    st[i].pgout = a->pgout;
+    st[i].pgin = a->pgin;
+    i++;
+  }
+  release(&swap.lock);
+  return i;
+}
+
+// Page back in the pages of the current process in swap
+// areas that are being turned off.  Called by the process
+// itself on its way to user space when swapgen has changed.
+void
+swapdrain(void)
+{
+  struct proc *p = myproc();
+  int draining[NSWAPAREA];
+  pte_t *pgtab;
+  uint gen, slot;
+  int i, j;
+
+  acquire(&swap.lock);
+  gen = swapgen;
+  for(i = 0; i < NSWAPAREA; i++)
+    draining[i] = swap.area[i].type >= 0 && swap.area[i].draining;
+  release(&swap.lock);
+
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(!PDE_PGTAB(p->pgdir[i]))
+      continue;
+    pgtab = (pte_t*)P2V(PTE_ADDR(p->pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++){
+      if(!(pgtab[j] & PTE_S))
+        continue;
+      slot = PTE_SWAPSLOT(pgtab[j]);
+      if(draining[SLOTAREA(slot)] &&
+         map_address(p->pgdir, PGADDR(i, j, 0), 0) < 0)
+        return;  // out of memory; try again next time
+    }
+  }
+  p->swapgen = gen;
+}
@@ -0,0 +1,24 @@
+// Swap areas.
+// Both the kernel and user programs use this header file.
+
+#define SWAP_ROOT  0   // free blocks of the root file system
+#define SWAP_DISK  1   // a whole IDE disk
+#define SWAP_FILE  2   // a swap file (swapon)
+#define SWAP_RAM   3   // the RAM disk (RAMSWAP in the Makefile)
+
+#define SWAP_PRIODISK  1  // priority of swap disks found at boot
+#define SWAP_PRIORAM   2  // priority of the RAM disk
+
+// One swap area, as returned by swapstat().
+struct swapstat {
+  int area;       // Index, the top bits of a slot number
+  int type;       // SWAP_ROOT, SWAP_DISK, SWAP_FILE or SWAP_RAM
+  int dev;        // Disk the area is on
+  uint inum;      // Inode number of a swap file
+  int prio;       // Higher is used first; -1 for SWAP_ROOT
+  int draining;   // Being turned off
+  uint nslot;     // Slots (pages) in the area
+  uint nused;     // Slots in use
+  uint pgout;     // Pages written since boot
+  uint pgin;      // Pages read since boot
+};
@@ -0,0 +1,25 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// swapoff file: stop swapping to file, waiting a while
+// for processes to page back in what is left in it.
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  if(argc != 2){
+    printf(2, "usage: swapoff file\n");
+    exit();
+  }
+  for(i = 0; swapoff(argv[1]) < 0; i++){
+    if(i == 10){
+      printf(2, "swapoff: %s failed\n", argv[1]);
+      break;
+    }
+    sleep(10);
+  }
+  exit();
+}
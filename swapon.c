@@ -0,0 +1,71 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "param.h"
+#include "swap.h"
+
+// swapon: list the swap areas.
+// swapon [-p prio] file [kbytes]: swap to file, with
+// priority prio (default 0), first creating it with the
+// given size if one is given.
+
+char buf[4096];
+
+void
+list(void)
+{
+  static char *types[] = {
+  [SWAP_ROOT]  "root",
+  [SWAP_DISK]  "disk",
+  [SWAP_FILE]  "file",
+  [SWAP_RAM]   "ram",
+  };
+  struct swapstat st[NSWAPAREA];
+  int i, n;
+
+  n = swapstat(st, NSWAPAREA);
+  printf(1, "area type dev inum prio pages used pgout pgin\n");
+  for(i = 0; i < n; i++)
+    printf(1, "%d %s %d %d %d %d %d %d %d%s\n", st[i].area,
+           types[st[i].type], st[i].dev, st[i].inum, st[i].prio,
+           st[i].nslot, st[i].nused, st[i].pgout, st[i].pgin,
+           st[i].draining ? " draining" : "");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, n, prio;
+
+  if(argc == 1){
+    list();
+    exit();
+  }
+  prio = 0;
+  if(strcmp(argv[1], "-p") == 0 && argc > 2){
+    prio = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if(argc < 2 || argc > 3){
+    printf(2, "usage: swapon [-p prio] file [kbytes]\n");
+    exit();
+  }
+  if(argc == 3){
+    if((fd = open(argv[1], O_CREATE|O_RDWR)) < 0){
+      printf(2, "swapon: cannot create %s\n", argv[1]);
+      exit();
+    }
+    for(n = atoi(argv[2]) / 4; n > 0; n--){
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf(2, "swapon: %s: write failed\n", argv[1]);
+        exit();
+      }
+    }
+    close(fd);
+  }
+  if(swapon(argv[1], prio) < 0)
+    printf(2, "swapon: %s failed\n", argv[1]);
+  exit();
+}
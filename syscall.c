@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "paging.h"
 
 // User code makes a system call with INT T_SYSCALL.
 // System call number in %eax.
@@ -13,13 +14,17 @@
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
 
+// User memory that a system call reads or writes is faulted in
+// here, before the call goes on to use it, since the kernel
+// must not take page faults while holding locks.
+
 // Fetch the int at addr from the current process.
 int
 fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(fault_in(curproc->pgdir, curproc, addr, 4, 0) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -34,11 +39,14 @@ fetchstr(uint addr, char **pp)
   char *s, *ep;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
+  if(addr >= KERNBASE)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
+  ep = (char*)KERNBASE;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) &&
+       fault_in(curproc->pgdir, curproc, (uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -52,27 +60,64 @@ argint(int n, int *ip)
   return fetchint((myproc()->tf->esp) + 4 + 4*n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+static int
+checkptr(int n, char **pp, int size, int write)
 {
   int i;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || (uint)i >= KERNBASE)
+    return -1;
+  if(fault_in(curproc->pgdir, curproc, i, size, write) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes.  Check that the pointer
+// lies within the process address space and that the kernel
+// may write it.
+int
+argptr(int n, char **pp, int size)
+{
+  return checkptr(n, pp, size, 1);
+}
+
+// Like argptr(), for a block the kernel only reads.
+int
+argrdptr(int n, char **pp, int size)
+{
+  return checkptr(n, pp, size, 0);
+}
+
+// Fetch the arguments of a system call such as kmemstat(buf, n)
+// that copies out records of size bytes: a buffer, in *pp, and
+// the number of records it has room for, which is returned,
+// cut down to max.  The caller fills in that many records in
+// a kernel array and copies them out with no lock held, since
+// the buffer may have to be faulted in.
+int
+argstats(char **pp, int size, int max)
+{
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > max)
+    n = max;
+  if(argptr(0, pp, n*size) < 0)
+    return -1;
+  return n;
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (Another process sharing a mapped file page could change the
+// string after this check, so the kernel must not rely on its
+// length staying the same.)
 int
 argstr(int n, char **pp)
 {
@@ -105,6 +150,22 @@ extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_bstat(void);
 extern int sys_swap(void);
+extern int sys_oomadj(void);
+extern int sys_oomlog(void);
+extern int sys_pagepolicy(void);
+extern int sys_swapon(void);
+extern int sys_swapoff(void);
+extern int sys_swapstat(void);
+extern int sys_kmemstat(void);
+extern int sys_kbuddystat(void);
+extern int sys_slabstat(void);
+extern int sys_vmstat(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_mprotect(void);
+extern int sys_uffd(void);
+extern int sys_ufregister(void);
+extern int sys_ufcopy(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -130,6 +191,22 @@ static int (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_bstat]   sys_bstat,
 [SYS_swap]    sys_swap,
+[SYS_oomadj]  sys_oomadj,
+[SYS_oomlog]  sys_oomlog,
+[SYS_pagepolicy] sys_pagepolicy,
+[SYS_swapon]  sys_swapon,
+[SYS_swapoff] sys_swapoff,
+[SYS_swapstat] sys_swapstat,
+[SYS_kmemstat] sys_kmemstat,
+[SYS_kbuddystat] sys_kbuddystat,
+[SYS_slabstat] sys_slabstat,
+[SYS_vmstat]  sys_vmstat,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_mprotect] sys_mprotect,
+[SYS_uffd]    sys_uffd,
+[SYS_ufregister] sys_ufregister,
+[SYS_ufcopy]  sys_ufcopy,
 };
 
 void
@@ -22,3 +22,19 @@
 #define SYS_close  21
 #define SYS_bstat  22
 #define SYS_swap   23
+#define SYS_oomadj 24
+#define SYS_oomlog 25
+#define SYS_pagepolicy 26
+#define SYS_swapon 27
+#define SYS_swapoff 28
+#define SYS_swapstat 29
+#define SYS_kmemstat 30
+#define SYS_kbuddystat 31
+#define SYS_slabstat 32
+#define SYS_vmstat 33
+#define SYS_mmap   34
+#define SYS_munmap 35
+#define SYS_mprotect 36
+#define SYS_uffd   37
+#define SYS_ufregister 38
+#define SYS_ufcopy 39
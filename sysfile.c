@@ -15,7 +15,9 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
 #include "paging.h"
+#include "swap.h"
 
 extern int numallocblocks;
 
@@ -88,7 +90,7 @@ sys_write(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argrdptr(1, &p, n) < 0)
     return -1;
   return filewrite(f, p, n);
 }
@@ -261,8 +263,10 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
-    panic("create: ialloc");
+  if((ip = ialloc(dp->dev, type)) == 0){
+    iunlockput(dp);
+    return 0;
+  }
 
   ilock(ip);
   ip->major = major;
@@ -271,15 +275,25 @@ create(char *path, short type, short major, short minor)
   iupdate(ip);
 
   if(type == T_DIR){  // Create . and .. entries.
-    dp->nlink++;  // for ".."
-    iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
     if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
       panic("create dots");
   }
 
-  if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+  // dirlookup() above fails, too, when there is no memory
+  // for the inode; the name may be there after all.
+  if(dirlink(dp, name, ip->inum) < 0){
+    ip->nlink = 0;
+    iupdate(ip);
+    iunlockput(ip);
+    iunlockput(dp);
+    return 0;
+  }
+
+  if(type == T_DIR){
+    dp->nlink++;  // for ".."
+    iupdate(dp);
+  }
 
   iunlockput(dp);
 
@@ -456,14 +470,168 @@ sys_bstat(void)
 }
 
 /* swap system call handler.
+ * Swap out the page containing addr.
  */
 int
 sys_swap(void)
 {
   uint addr;
+  pte_t *pte;
+  struct proc *curproc = myproc();
 
   if(argint(0, (int*)&addr) < 0)
     return -1;
-  // swap addr
+  if(findvma(curproc, addr) == 0)
+    return -1;
+  pte = uva2pte(curproc->pgdir, PGROUNDDOWN(addr));
+  if(pte == 0 || (*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+    return -1;
+  if(*pte & PTE_F)
+    return -1;  // pages of files are not swapped
+  return swap_page_at(curproc->pgdir, PGROUNDDOWN(addr));
+}
+
+/* Swap to the regular file path with priority prio.  Its
+ * size should be a multiple of the page size; it is not
+ * writable while in use.
+ */
+int
+sys_swapon(void)
+{
+  char *path;
+  struct inode *ip;
+  int prio;
+
+  if(argstr(0, &path) < 0 || argint(1, &prio) < 0)
+    return -1;
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  ilock(ip);
+  if(swapon(ip, prio) < 0){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+  iunlock(ip);  // the swap area keeps the reference
+  end_op();
+  return 0;
+}
+
+/* Stop swapping to the file path.  Fails while pages are
+ * still in it; it can then be retried once processes have
+ * paged them back in.
+ */
+int
+sys_swapoff(void)
+{
+  char *path;
+  struct inode *ip;
+  int r;
+
+  if(argstr(0, &path) < 0)
+    return -1;
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  end_op();
+  // Paging in what is left in the file takes a while.
+  ilock(ip);
+  r = swapoff(ip);
+  iunlock(ip);
+  begin_op();
+  if(r == 0)
+    iput(ip);  // the swap area's reference
+  iput(ip);
+  end_op();
+  return r;
+}
+
+/* Copy out the state of up to n swap areas.
+ */
+int
+sys_swapstat(void)
+{
+  struct swapstat *ust, st[NSWAPAREA];
+  int n;
+
+  if((n = argstats((char**)&ust, sizeof(st[0]), NSWAPAREA)) < 0)
+    return -1;
+  n = swapstat(st, n);
+  memmove(ust, st, n*sizeof(st[0]));
+  return n;
+}
+
+/* Map len bytes of memory into the address space, at or
+ * near addr, with protection prot: private anonymous memory
+ * (MAP_PRIVATE|MAP_ANON), for which fd and off are ignored, or
+ * the regular file open as fd from offset off, MAP_SHARED or
+ * MAP_PRIVATE.  The file must be open for reading, and for
+ * writing too if a shared mapping may write it.  Returns the
+ * address, or -1.
+ */
+int
+sys_mmap(void)
+{
+  int addr, len, prot, flags, off;
+  struct file *f;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  f = 0;
+  if(!(flags & MAP_ANON)){
+    if(argfd(4, 0, &f) < 0 || f->type != FD_INODE || f->ip->type != T_FILE ||
+       f->ip->swap)
+      return -1;
+    if(!f->readable || ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable))
+      return -1;
+  }
+  return vmamap(myproc(), addr, len, prot, flags, f, off);
+}
+
+/* Return a descriptor on which the faults in regions later
+ * registered with ufregister() can be read (struct ufevent)
+ * and answered with ufcopy().
+ */
+int
+sys_uffd(void)
+{
+  struct file *f;
+  int fd;
+
+  if(ufalloc(myproc(), &f) < 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    ufdetach(myproc());
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+/* Fill in the len bytes of pages at dst, in the process that
+ * made the userfault descriptor fd, with the bytes at src.
+ * It must be waiting for each of the pages.
+ */
+int
+sys_ufcopy(void)
+{
+  struct file *f;
+  int dst, len, i;
+  char *src;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &dst) < 0 || argint(3, &len) < 0 ||
+     argrdptr(2, &src, len) < 0)
+    return -1;
+  if(f->type != FD_UF || len % PGSIZE != 0)
+    return -1;
+  for(i = 0; i < len; i += PGSIZE)
+    if(ufcopy(f->uf, dst + i, src + i) < 0)
+      return -1;
   return 0;
 }
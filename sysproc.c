@@ -6,6 +6,9 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "oom.h"
+#include "paging.h"
+#include "kmem.h"
 
 int
 sys_fork(void)
@@ -89,3 +92,127 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// set the OOM badness bias of a process.
+int
+sys_oomadj(void)
+{
+  int pid, adj;
+
+  if(argint(0, &pid) < 0 || argint(1, &adj) < 0)
+    return -1;
+  return oomadj(pid, adj);
+}
+
+// copy the most recent OOM killer events to user space.
+int
+sys_oomlog(void)
+{
+  struct oomevent *uev, ev[NOOMLOG];
+  int n;
+
+  if((n = argstats((char**)&uev, sizeof(ev[0]), NOOMLOG)) < 0)
+    return -1;
+  n = oomlog(ev, n);
+  memmove(uev, ev, n*sizeof(ev[0]));
+  return n;
+}
+
+// copy the page magazine counters of each CPU to user space.
+int
+sys_kmemstat(void)
+{
+  struct kmemstat *ust, st[NCPU];
+  int n;
+
+  if((n = argstats((char**)&ust, sizeof(st[0]), NCPU)) < 0)
+    return -1;
+  n = kmemstat(st, n);
+  memmove(ust, st, n*sizeof(st[0]));
+  return n;
+}
+
+// copy the number of free blocks of each order to user space.
+int
+sys_kbuddystat(void)
+{
+  uint *unblock, nblock[NORDER];
+  int n;
+
+  if((n = argstats((char**)&unblock, sizeof(nblock[0]), NORDER)) < 0)
+    return -1;
+  n = kbuddystat(nblock, n);
+  memmove(unblock, nblock, n*sizeof(nblock[0]));
+  return n;
+}
+
+// copy the state of the slab caches to user space.
+int
+sys_slabstat(void)
+{
+  struct slabstat *ust, st[NSLABCACHE];
+  int n;
+
+  if((n = argstats((char**)&ust, sizeof(st[0]), NSLABCACHE)) < 0)
+    return -1;
+  n = slabstat(st, n);
+  memmove(ust, st, n*sizeof(st[0]));
+  return n;
+}
+
+// copy the virtual memory counters to user space.
+int
+sys_vmstat(void)
+{
+  struct vmstat *st;
+
+  if(argptr(0, (char**)&st, sizeof(*st)) < 0)
+    return -1;
+  *st = vmstat;
+  return 0;
+}
+
+// switch the page replacement policy; -1 just queries it.
+int
+sys_pagepolicy(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return setpagepolicy(id);
+}
+
+// unmap pages of a region made by mmap.
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return vmaunmap(myproc(), addr, len);
+}
+
+// have another process fill in pages made by mmap,
+// through the descriptor from uffd.
+int
+sys_ufregister(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return vmaregister(myproc(), addr, len);
+}
+
+// change the protection of pages made by mmap.
+int
+sys_mprotect(void)
+{
+  int addr, len, prot;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0)
+    return -1;
+  return vmaprotect(myproc(), addr, len, prot);
+}
@@ -0,0 +1,143 @@
+// TLB shootdown.
+//
+// A CPU caches the translations of the page table it has
+// loaded, and keeps them after its PTEs change until it is
+// told to drop them.  Whoever unmaps or remaps user pages calls
+// tlbflush() once for the whole run of pages it changed: the
+// local TLB is flushed if the page table is loaded here, and
+// every other CPU that has it loaded (cpu->pgdir, kept by
+// switchuvm() and the scheduler) gets one interrupt, T_IRQ0 +
+// IRQ_TLB, and flushes its own.  tlbflush() returns once all
+// of them have done so, when the old pages may be reused.
+//
+// Runs of more than TLBFULL pages flush the whole TLB rather
+// than each page with invlpg.
+//
+// One shootdown is in flight at a time.  A CPU waiting for its
+// turn, with interrupts off, answers shootdowns meanwhile, so
+// two CPUs shooting at each other cannot deadlock.  For the
+// same reason a CPU spinning in acquire() answers them too
+// (tlbpoll), so the caller may hold spinlocks: a CPU waiting
+// for one of them still flushes.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "traps.h"
+#include "proc.h"
+#include "paging.h"
+#include "kmem.h"
+
+#define TLBFULL  32      // longest run flushed page by page
+
+static struct {
+  volatile uint busy;    // a shootdown is in flight
+  pde_t *pgdir;          // its page table,
+  uint va;               // first page
+  uint n;                // and number of pages
+  volatile int pending[NCPU];  // CPUs yet to flush
+} tlb;
+
+// Drop this CPU's translations of the n pages at va in pgdir,
+// if pgdir is loaded.
+static void
+flush(pde_t *pgdir, uint va, uint n)
+{
+  if(rcr3() != V2P(pgdir))
+    return;  // loading another page table flushed them
+  if(n > TLBFULL){
+    lcr3(rcr3());
+    return;
+  }
+  for(; n > 0; n--, va += PGSIZE)
+    invlpg((void*)va);
+}
+
+// Answer a shootdown aimed at this CPU, if any.
+// Called with interrupts off.
+static void
+answer(void)
+{
+  int i;
+
+  i = cpuid();
+  if(tlb.pending[i]){
+    flush(tlb.pgdir, tlb.va, tlb.n);
+    __sync_synchronize();
+    tlb.pending[i] = 0;
+  }
+}
+
+// The shootdown interrupt.
+void
+tlbintr(void)
+{
+  answer();
+}
+
+// Answer shootdowns while spinning with interrupts off.
+void
+tlbpoll(void)
+{
+  answer();
+}
+
+// The n pages at va in pgdir have been unmapped or remapped:
+// make every CPU drop its translations of them.
+void
+tlbflush(pde_t *pgdir, uint va, uint n)
+{
+  struct cpu *c;
+  uint t, nipi;
+  int i, me;
+
+  if(n == 0)
+    return;
+  pushcli();
+  me = cpuid();
+  vmstat.tlbflush++;
+  if(n > TLBFULL)
+    vmstat.tlbfull++;
+  flush(pgdir, va, n);
+
+  // The PTE stores must be seen before cpu->pgdir is read:
+  // a CPU loading pgdir after that walks the new PTEs.
+  __sync_synchronize();
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c - cpus != me && c->pgdir == pgdir)
+      break;
+  if(c == cpus+ncpu){
+    popcli();
+    return;
+  }
+  while(xchg(&tlb.busy, 1) != 0)
+    answer();
+  t = rdtsc();
+  tlb.pgdir = pgdir;
+  tlb.va = va;
+  tlb.n = n;
+  nipi = 0;
+  for(c = cpus; c < cpus+ncpu; c++){
+    i = c - cpus;
+    if(i == me || c->pgdir != pgdir)
+      continue;
+    tlb.pending[i] = 1;
+    __sync_synchronize();
+    lapicipi(c->apicid, T_IRQ0 + IRQ_TLB);
+    nipi++;
+  }
+  for(i = 0; i < ncpu; i++)
+    while(tlb.pending[i])
+      ;
+  t = rdtsc() - t;
+  vmstat.tlbshoot++;
+  vmstat.tlbipi += nipi;
+  vmstat.tlbwait += t >> 10;
+  if(t > vmstat.tlbmaxwait)
+    vmstat.tlbmaxwait = t;
+  xchg(&tlb.busy, 0);
+  popcli();
+}
@@ -1,5 +1,10 @@
 struct stat;
 struct rtcdate;
+struct oomevent;
+struct swapstat;
+struct kmemstat;
+struct slabstat;
+struct vmstat;
 
 // system calls
 int fork(void);
@@ -25,6 +30,22 @@ int sleep(int);
 int uptime(void);
 int bstat(void);
 int swap(void*);
+int oomadj(int, int);
+int oomlog(struct oomevent*, int);
+int pagepolicy(int);
+int swapon(char*, int);
+int swapoff(char*);
+int swapstat(struct swapstat*, int);
+int kmemstat(struct kmemstat*, int);
+int kbuddystat(uint*, int);
+int slabstat(struct slabstat*, int);
+int vmstat(struct vmstat*);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int mprotect(void*, int, int);
+int uffd(void);
+int ufregister(void*, int);
+int ufcopy(int, void*, void*, int);
 
 // ulib.c
 int stat(char*, struct stat*);
@@ -0,0 +1,277 @@
+// User page fault handling.
+//
+// A process can have the pages of some of its anonymous mmap()
+// regions filled in by another process instead of zeroed, so
+// that an application decides what a page holds when it is
+// first touched: decompressed, read from a file, or computed.
+// uffd() gives the process a userfault object, p->uf, and a
+// file descriptor for it; ufregister() marks regions (VMA_UF).
+// A fault on a missing page of such a region blocks the process
+// and posts an event, which a handler, usually a child sharing
+// the descriptor, gets by reading it (struct ufevent).  The
+// handler answers with ufcopy(), which copies a page of its own
+// memory for the process to map.
+//
+// The handler never touches the other process's page table:
+// ufcopy() leaves the page in the slot of the fault, and the
+// process maps it when it wakes.  So only a process changes
+// its own address space, as vma.c assumes.  A page can only
+// be filled in once it is faulted on: one filled in ahead of
+// time would hold a slot until the process touched it, which
+// it might never do.
+//
+// Once the descriptor is closed, faults zero-fill as usual.
+// Reading it returns 0 once the process has exited or exec'd.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "paging.h"
+#include "userfault.h"
+
+#define NUFSLOT 16  // pages faulted on, not yet mapped
+
+struct ufslot {
+  uint va;        // page, or 0 if the slot is free
+  char *page;     // contents from ufcopy(), or 0 while waiting
+  int reported;   // handler has read the event?
+  uint flags;     // UF_WRITE
+};
+
+struct userfault {
+  struct spinlock lock;
+  struct ufslot slot[NUFSLOT];
+  int attached;   // the process still has it (p->uf)
+  int open;       // the descriptor is still open
+};
+
+static struct slabcache *ufcache;
+
+static void
+ufctor(void *uf)
+{
+  initlock(&((struct userfault*)uf)->lock, "userfault");
+}
+
+void
+ufinit(void)
+{
+  ufcache = slabcreate("userfault", sizeof(struct userfault), ufctor);
+}
+
+// Give p a userfault object, replacing one whose descriptor
+// is closed, and return a file for it in *f.
+int
+ufalloc(struct proc *p, struct file **f)
+{
+  struct userfault *uf;
+
+  if(p->uf && p->uf->open)
+    return -1;
+  if((*f = filealloc()) == 0)
+    return -1;
+  if((uf = slaballoc(ufcache)) == 0){
+    fileclose(*f);
+    return -1;
+  }
+  ufdetach(p);
+  memset(uf->slot, 0, sizeof(uf->slot));
+  uf->attached = 1;
+  uf->open = 1;
+  (*f)->type = FD_UF;
+  (*f)->readable = 1;
+  (*f)->writable = 0;
+  (*f)->uf = uf;
+  p->uf = uf;
+  return 0;
+}
+
+// Free the pages filled in for uf, and uf itself if nothing
+// refers to it any more.  Releases uf->lock.
+static void
+ufput(struct userfault *uf)
+{
+  struct ufslot *s;
+  int dead;
+
+  if(!uf->attached){
+    for(s = uf->slot; s < &uf->slot[NUFSLOT]; s++){
+      if(s->page)
+        kfree(s->page);
+      s->va = 0;
+      s->page = 0;
+    }
+  }
+  dead = !uf->attached && !uf->open;
+  release(&uf->lock);
+  if(dead)
+    slabfree(ufcache, uf);
+}
+
+// The descriptor of uf has been closed.
+void
+ufclose(struct userfault *uf)
+{
+  struct ufslot *s;
+
+  acquire(&uf->lock);
+  uf->open = 0;
+  wakeup(uf->slot);
+  for(s = uf->slot; s < &uf->slot[NUFSLOT]; s++)
+    wakeup(s);
+  ufput(uf);
+}
+
+// p is exiting or replacing its address space: its faults no
+// longer go to p->uf.
+void
+ufdetach(struct proc *p)
+{
+  struct userfault *uf;
+
+  if((uf = p->uf) == 0)
+    return;
+  p->uf = 0;
+  acquire(&uf->lock);
+  uf->attached = 0;
+  wakeup(uf);
+  ufput(uf);
+}
+
+static struct ufslot*
+find(struct userfault *uf, uint va)
+{
+  struct ufslot *s;
+
+  for(s = uf->slot; s < &uf->slot[NUFSLOT]; s++)
+    if(s->va == va)
+      return s;
+  return 0;
+}
+
+// Read the next fault event of uf into addr, waiting for one.
+// Returns the size of an event, or 0 once the process is gone.
+int
+ufread(struct userfault *uf, char *addr, int n)
+{
+  struct ufevent ev;
+  struct ufslot *s;
+
+  if(n < sizeof(ev))
+    return -1;
+  acquire(&uf->lock);
+  for(;;){
+    if(!uf->attached){
+      release(&uf->lock);
+      return 0;
+    }
+    for(s = uf->slot; s < &uf->slot[NUFSLOT]; s++)
+      if(s->va && !s->reported)
+        break;
+    if(s < &uf->slot[NUFSLOT])
+      break;
+    if(myproc()->killed){
+      release(&uf->lock);
+      return -1;
+    }
+    sleep(uf, &uf->lock);
+  }
+  s->reported = 1;
+  ev.addr = s->va;
+  ev.flags = s->flags;
+  release(&uf->lock);
+  // Copy with no lock held: addr may have been swapped out.
+  memmove(addr, &ev, sizeof(ev));
+  return sizeof(ev);
+}
+
+// Fill in page va of uf's process with the page at src.
+// Returns -1 if the process is not waiting for va, or it
+// already has been filled in.
+int
+ufcopy(struct userfault *uf, uint va, char *src)
+{
+  struct ufslot *s;
+  char *mem;
+
+  if(va % PGSIZE != 0 || va == 0 || va >= MMAPTOP)
+    return -1;
+  if((mem = allocpage(0)) == 0)
+    return -1;
+  memmove(mem, src, PGSIZE);
+  acquire(&uf->lock);
+  if(!uf->attached)
+    goto bad;
+  if((s = find(uf, va)) == 0 || s->page)
+    goto bad;
+  s->page = mem;
+  wakeup(s);
+  release(&uf->lock);
+  return 0;
+
+bad:
+  release(&uf->lock);
+  kfree(mem);
+  return -1;
+}
+
+// Fill in the missing page va of p, in a region registered
+// with p->uf, with permissions perm: wait for the handler to
+// fill it in, unless the descriptor is closed, and map it.
+// Returns -1 if p is killed or out of memory.
+int
+ufault(struct proc *p, uint va, uint perm, int write)
+{
+  struct userfault *uf;
+  struct ufslot *s;
+  char *mem;
+
+  uf = p->uf;
+  acquire(&uf->lock);
+  while((s = find(uf, va)) == 0 && uf->open){
+    if((s = find(uf, 0)) != 0){
+      s->va = va;
+      s->page = 0;
+      s->reported = 0;
+      s->flags = write ? UF_WRITE : 0;
+      wakeup(uf);
+      break;
+    }
+    if(p->killed)
+      goto bad;
+    sleep(uf->slot, &uf->lock);  // for a free slot
+  }
+  while(s && s->page == 0 && uf->open){
+    if(p->killed)
+      goto bad;
+    sleep(s, &uf->lock);
+  }
+  mem = 0;
+  if(s && (mem = s->page) != 0){
+    s->va = 0;
+    s->page = 0;
+    wakeup(uf->slot);
+  } else if(s){
+    s->va = 0;  // the descriptor was closed
+    wakeup(uf->slot);
+  }
+  release(&uf->lock);
+  if(mem)
+    return map_filled(p->pgdir, va, mem, perm);
+  return map_address(p->pgdir, va, perm);
+
+bad:
+  if(s && s->page == 0){
+    s->va = 0;
+    wakeup(uf->slot);
+  }
+  release(&uf->lock);
+  return -1;
+}
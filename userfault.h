@@ -0,0 +1,9 @@
+// Events read from a userfault descriptor (uffd()).
+// Both the kernel and user programs use this header file.
+
+struct ufevent {
+  uint addr;     // page faulted on
+  uint flags;
+};
+
+#define UF_WRITE 0x1  // the fault was a write
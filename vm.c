@@ -41,13 +41,14 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return 0;  // a 4 MB page has no page table
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -87,6 +88,14 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 // page protection bits prevent user code from using the kernel's
 // mappings.
 //
+// kvmalloc() builds the kernel part once, in kpgdir, and
+// setupkvm() copies its page directory entries into every new
+// page table, so that all page tables share the kernel's page
+// table pages.  The kernel mappings are global (PTE_G), so they
+// stay in the TLB across switches between page tables, and
+// use 4 MB pages (PTE_PS) wherever a whole 4 MB is mapped
+// alike.  They never change once built.
+//
 // setupkvm() and exec() set up every page table like this:
 //
 //   0..KERNBASE: user memory (text+data+stack+heap), mapped to
@@ -94,16 +103,18 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
-//   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP,
+//   data..KERNBASE+phystop: mapped to V2P(data)..phystop,
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and the end of physical memory (phystop,
+// found at boot by meminit, at most PHYSMAX)
+// (directly addressable from end..P2V(phystop)).
 
 // This table defines the kernel's mappings, which are present in
-// every process's page table.
+// every process's page table.  The end of kern data+memory is
+// filled in by kvmalloc once phystop is known.
 static struct kmap {
   void *virt;
   uint phys_start;
@@ -112,7 +123,7 @@ static struct kmap {
 } kmap[] = {
  { (void*)KERNBASE, 0,             EXTMEM,    PTE_W}, // I/O space
  { (void*)KERNLINK, V2P(KERNLINK), V2P(data), 0},     // kern text+rodata
- { (void*)data,     V2P(data),     PHYSTOP,   PTE_W}, // kern data+memory
+ { (void*)data,     V2P(data),     0,         PTE_W}, // kern data+memory
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
@@ -121,28 +132,48 @@ pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kzalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
+// Map size bytes at va to pa in kpgdir: with 4 MB pages
+// where both are aligned, with page table pages elsewhere.
+static void
+kmappages(uint va, uint size, uint pa, int perm)
+{
+  uint n;
+
+  for(; size > 0; va += n, pa += n, size -= n){
+    n = SPGSIZE - va%SPGSIZE;
+    if(n > size)
+      n = size;
+    if(n == SPGSIZE && pa%SPGSIZE == 0)
+      kpgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS | PTE_G;
+    else if(mappages(kpgdir, (void*)va, n, pa, perm | PTE_G) < 0)
+      panic("kvmalloc");
+  }
+}
+
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes, and the kernel part of every
+// other page table.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if (P2V(phystop) > (void*)DEVSPACE)
+    panic("phystop too high");
+  kmap[2].phys_end = phystop;
+  if((kpgdir = (pde_t*)kzalloc()) == 0)
+    panic("kvmalloc");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    kmappages((uint)k->virt, k->phys_end - k->phys_start,
+              k->phys_start, k->perm);
   switchkvm();
 }
 
@@ -175,6 +206,7 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
+  mycpu()->pgdir = p->pgdir;
   lcr3(V2P(p->pgdir));  // switch to process's address space
   popcli();
 }
@@ -188,8 +220,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -226,7 +257,7 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz > KERNBASE)
     return 0;
   if(newsz < oldsz)
     return oldsz;
@@ -234,19 +265,20 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   a = PGROUNDUP(oldsz);
   
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = allocpage(1);
     if(mem == 0){
       //cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       //cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
       kfree(mem);
       return 0;
     }
+    pagepolicy->fault(V2P(mem));
+    rmapset(V2P(mem), pgdir, a);
   }
   return newsz;
 }
@@ -255,7 +287,10 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
-// If the page was swapped free the corresponding disk block.
+// Swapped pages drop their reference to the swap slot; slots
+// freed by that are returned to the disk in one batch.  Pages
+// of files drop their reference to the page cache, and may be
+// written back, so deallocuvm() may sleep.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
@@ -267,23 +302,45 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS){
+      if(a % SPGSIZE == 0 && a + SPGSIZE <= oldsz){
+        freesuper(pgdir, a);
+        a += SPGSIZE - PGSIZE;
+        continue;
+      }
+      // Keep the rest; the frame at a, about to be freed,
+      // serves as the page table.
+      splitsuper(pgdir, a, P2V(PTE_ADDR(pgdir[PDX(a)]) + a%SPGSIZE));
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
-    else if((*pte & PTE_P) != 0){
+    else if((*pte & (PTE_P|PTE_F)) == (PTE_P|PTE_F)){
+      // A page of a file: written back if dirtied here.
+      pa = PTE_ADDR(*pte);
+      *pte &= ~PTE_P;
+      pcput(P2V(pa), *pte & PTE_D);
+      *pte = 0;
+    } else if((*pte & PTE_P) != 0){
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
       char *v = P2V(pa);
+      if(*pte & PTE_U)
+        pagepolicy->free(pa);
+      rmapclear(pa);
       kfree(v);
       *pte = 0;
+    } else if((*pte & PTE_S) != 0){
+      swapfree(PTE_SWAPSLOT(*pte));
+      *pte = 0;
     }
   }
   return newsz;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part.  The kernel part belongs to kpgdir.
 void
 freevm(pde_t *pgdir)
 {
@@ -292,7 +349,7 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -301,49 +358,49 @@ freevm(pde_t *pgdir)
   kfree((char*)pgdir);
 }
 
-// Select a page-table entry which is mapped
-// but not accessed. Notice that the user memory
-// is mapped between 0...KERNBASE.
-/*pte_t*
-select_a_victim(pde_t *pgdir)
-{
-	return 0;
-}*/
-
-// // Clear access bit of a random pte.
-// void
-// clearaccessbit(pde_t *pgdir)
-// {
-// }
-
-// return the disk block-id, if the virtual address
-// was swapped, -1 otherwise.
-/*int
-getswappedblk(pde_t *pgdir, uint va)
-{
-  return -1;
-}*/
-
-// Clear PTE_U on a page. Used to create an inaccessible
-// page beneath the user stack.
-void
-clearpteu(pde_t *pgdir, char *uva)
+// Set the PTE_U and PTE_W bits of the user pages of pgdir in
+// [start, end), resident or swapped out, to perm.  Returns -1
+// if a superpage that needs splitting cannot be.
+int
+protectuvm(pde_t *pgdir, uint start, uint end, uint perm)
 {
   pte_t *pte;
+  uint a;
 
-  pte = walkpgdir(pgdir, uva, 0);
-  if(pte == 0)
-    panic("clearpteu");
-  *pte &= ~PTE_U;
+  for(a = start; a < end; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS){
+      if(a % SPGSIZE == 0 && a + SPGSIZE <= end){
+        pgdir[PDX(a)] = (pgdir[PDX(a)] & ~(PTE_U|PTE_W)) | perm;
+        a += SPGSIZE - PGSIZE;
+        continue;
+      }
+      if(splitsuper(pgdir, a, 0) < 0)
+        return -1;
+    }
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    // A page of a file gains PTE_W only when written (vmafault).
+    if(*pte & PTE_F)
+      *pte = (*pte & ~(PTE_U|PTE_W)) | (perm & (PTE_U | *pte));
+    else if(*pte & (PTE_P|PTE_S))
+      *pte = (*pte & ~(PTE_U|PTE_W)) | perm;
+  }
+  return 0;
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  Pages that were never touched stay
+// unallocated, and swapped-out pages are shared with the
+// parent through the swap slot's reference count, so the
+// child reads them back only if it touches them.  Mapped
+// pages of files are shared through the page cache.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint pa, i, flags;
   char *mem;
 
@@ -351,18 +408,46 @@ copyuvm(pde_t *pgdir, uint sz)
     return 0;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    if(pgdir[PDX(i)] & PTE_PS){
+      if(copysuper(d, pgdir, i) == 0){
+        i += SPGSIZE - PGSIZE;
+        continue;
+      }
+      if(splitsuper(pgdir, i, 0) < 0)
+        goto bad;
+    }
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(!(*pte & (PTE_P|PTE_S)))
+      continue;
+    if((npte = walkpgdir(d, (void *) i, 1)) == 0)
+      goto bad;
+    if(*pte & PTE_F){
+      // Share the page of the file; the parent's writes to it
+      // are the parent's to write back.
+      pcdup(P2V(PTE_ADDR(*pte)));
+      *npte = *pte & ~PTE_D;
+      continue;
+    }
+    mem = 0;
+    if((*pte & PTE_P) && (mem = allocpage(0)) == 0)
+      goto bad;
+    // allocpage() may have swapped the parent's page out.
+    if(*pte & PTE_S){
+      if(mem)
+        kfree(mem);
+      swapdup(PTE_SWAPSLOT(*pte));
+      *npte = *pte;
+      continue;
+    }
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-
     memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0)
-      goto bad;
+    *npte = V2P(mem) | flags;
+    pagepolicy->fault(V2P(mem));
+    rmapset(V2P(mem), d, i);
   }
   return d;
 
@@ -379,7 +464,7 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -397,12 +482,20 @@ uva2pte(pde_t *pgdir, uint uva)
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
+// Swapped-out pages of the range are faulted in first, as
+// are missing pages if pgdir is the current process's.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
+  struct proc *curproc = myproc();
   char *buf, *pa0;
   uint n, va0;
 
+  if(curproc && curproc->pgdir != pgdir)
+    curproc = 0;
+  if(fault_in(pgdir, curproc, va, len, 1) < 0)
+    return -1;
+
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
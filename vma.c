@@ -0,0 +1,375 @@
+// Memory regions.
+//
+// Each process describes its address space with a short array
+// of regions, p->vma, sorted by address.  The first is the
+// heap, [0, sz), which holds the program image too and moves
+// only with sbrk(); the last is the stack, USTACKSIZE bytes
+// below USTACKTOP, of which pages are filled in only as the
+// stack grows into them.  mmap() adds anonymous or file regions
+// in between, munmap() removes pages from them, and mprotect()
+// changes their protection, splitting regions where needed.  A
+// page fault in a region allocates a zeroed page or maps a page
+// of the file from the page cache (pagecache.c); a fault
+// anywhere else, such as in the gap left below the stack, kills
+// the process.
+//
+// Faults on missing pages of regions registered with
+// ufregister() (VMA_UF) are handed to another process
+// (userfault.c).
+//
+// A shared file mapping maps the cached pages themselves.  A
+// private one maps them read-only, and a write fault gives the
+// process its own copy, an anonymous page from then on.  A
+// region holds a reference to its file.
+//
+// Only the process itself changes its regions, so they need
+// no lock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+#include "paging.h"
+
+// Give p just a heap of sz bytes and a stack, as exec() and
+// userinit() do.
+void
+vmainit(struct proc *p, uint sz)
+{
+  p->vma[0].start = 0;
+  p->vma[0].end = sz;
+  p->vma[0].prot = PROT_READ|PROT_WRITE;
+  p->vma[0].flags = 0;
+  p->vma[0].f = 0;
+  p->vma[1] = p->vma[0];
+  p->vma[1].start = USTACKTOP - USTACKSIZE;
+  p->vma[1].end = USTACKTOP;
+  p->vma[1].flags = MAP_PRIVATE|MAP_ANON;
+  p->nvma = 2;
+}
+
+// Give np a copy of p's regions, as fork() does.  Faults in
+// np's copies of VMA_UF regions zero-fill as usual.
+void
+vmadup(struct proc *np, struct proc *p)
+{
+  int i;
+
+  for(i = 0; i < p->nvma; i++){
+    np->vma[i] = p->vma[i];
+    np->vma[i].flags &= ~VMA_UF;
+    if(np->vma[i].f)
+      filedup(np->vma[i].f);
+  }
+  np->nvma = p->nvma;
+}
+
+// Remove all of p's regions but the heap, the stack too,
+// freeing their pages, as exec() and exit() do.
+void
+vmaclear(struct proc *p)
+{
+  struct vma *v;
+
+  if(p->nvma <= 1)
+    return;
+  for(v = &p->vma[p->nvma-1]; v > p->vma; v--){
+    // Write back and free the pages while the file is open.
+    deallocuvm(p->pgdir, v->end, v->start);
+    if(v->f)
+      fileclose(v->f);
+  }
+  tlbflush(p->pgdir, p->vma[1].start,
+           (p->vma[p->nvma-1].end - p->vma[1].start) / PGSIZE);
+  p->nvma = 1;
+}
+
+// The region of p containing va, or 0.
+struct vma*
+findvma(struct proc *p, uint va)
+{
+  int i;
+
+  for(i = 0; i < p->nvma && p->vma[i].start <= va; i++)
+    if(va < p->vma[i].end)
+      return &p->vma[i];
+  return 0;
+}
+
+// PTE permission bits for pages of region v.
+uint
+vmaperm(struct vma *v)
+{
+  if(v->prot == PROT_NONE)
+    return 0;
+  return PTE_U | ((v->prot & PROT_WRITE) ? PTE_W : 0);
+}
+
+// Move the end of p's heap to sz, if no region is in the way.
+int
+vmaheap(struct proc *p, uint sz)
+{
+  if(sz > MMAPTOP || (p->nvma > 1 && PGROUNDUP(sz) > p->vma[1].start))
+    return -1;
+  p->vma[0].end = sz;
+  return 0;
+}
+
+// Does any region of p overlap [start, end)?
+static int
+overlaps(struct proc *p, uint start, uint end)
+{
+  int i;
+
+  for(i = 0; i < p->nvma; i++)
+    if(PGROUNDUP(p->vma[i].end) > start && p->vma[i].start < end)
+      return 1;
+  return 0;
+}
+
+// Add region v to p, keeping the array sorted.
+static int
+insert(struct proc *p, struct vma *v)
+{
+  int i;
+
+  if(p->nvma == NVMA)
+    return -1;
+  for(i = p->nvma; i > 0 && p->vma[i-1].start > v->start; i--)
+    p->vma[i] = p->vma[i-1];
+  p->vma[i] = *v;
+  p->nvma++;
+  return 0;
+}
+
+static void
+removevma(struct proc *p, int i)
+{
+  for(p->nvma--; i < p->nvma; i++)
+    p->vma[i] = p->vma[i+1];
+}
+
+// Make sure no region of p straddles va, by splitting the one
+// that does.  Returns -1 if there is no room for another.
+static int
+split(struct proc *p, uint va)
+{
+  struct vma *v, hi;
+
+  if((v = findvma(p, va)) == 0 || v->start == va)
+    return 0;
+  hi = *v;
+  hi.start = va;
+  hi.off += va - v->start;
+  if(insert(p, &hi) < 0)
+    return -1;
+  findvma(p, va - 1)->end = va;
+  if(hi.f)
+    filedup(hi.f);
+  return 0;
+}
+
+// Find room for len bytes: at addr if that is free, else as
+// high below MMAPTOP as possible.  Returns 0 if there is none.
+static uint
+findgap(struct proc *p, uint addr, uint len)
+{
+  uint lo, hi;
+  int i;
+
+  if(addr != 0 && addr % PGSIZE == 0 && addr + len > addr &&
+     addr + len <= MMAPTOP && !overlaps(p, addr, addr + len))
+    return addr;
+  hi = MMAPTOP;
+  for(i = p->nvma - 1; i >= 0; i--){
+    if(p->vma[i].start >= MMAPTOP)
+      continue;  // the stack
+    lo = PGROUNDUP(p->vma[i].end);
+    if(hi >= lo && hi - lo >= len)
+      return hi - len;
+    hi = p->vma[i].start;
+  }
+  return 0;
+}
+
+// Check that [addr, addr+len) is a page-aligned range above
+// p's heap, and return its end, or 0 if it is not.
+static uint
+rangeend(struct proc *p, uint addr, uint len)
+{
+  uint end;
+
+  end = addr + PGROUNDUP(len);
+  if(addr % PGSIZE != 0 || len == 0 || end <= addr || end > MMAPTOP ||
+     addr < PGROUNDUP(p->sz))
+    return 0;
+  return end;
+}
+
+// Map len bytes of f from offset off, or of zero-filled memory
+// if flags has MAP_ANON, with protection prot into p: at addr
+// if flags has MAP_FIXED (replacing what was there), and
+// preferably there otherwise.  Pages are filled in when
+// touched.  Returns the address, or -1.
+int
+vmamap(struct proc *p, uint addr, uint len, int prot, int flags,
+       struct file *f, uint off)
+{
+  struct vma v;
+  int type;
+
+  if(len == 0 || len > MMAPTOP)
+    return -1;
+  if((prot & ~(PROT_READ|PROT_WRITE)) != 0)
+    return -1;
+  type = flags & (MAP_SHARED|MAP_PRIVATE);
+  if(type != MAP_SHARED && type != MAP_PRIVATE)
+    return -1;
+  if(flags & MAP_ANON){
+    if(type == MAP_SHARED)
+      return -1;  // no shared anonymous memory
+    f = 0;
+    off = 0;
+  } else if(f == 0 || off % PGSIZE != 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if(flags & MAP_FIXED){
+    if(rangeend(p, addr, len) == 0 || vmaunmap(p, addr, len) < 0)
+      return -1;
+  } else if((addr = findgap(p, addr, len)) == 0)
+    return -1;
+  v.start = addr;
+  v.end = addr + len;
+  v.prot = prot;
+  v.flags = flags;
+  v.f = f;
+  v.off = off;
+  if(insert(p, &v) < 0)
+    return -1;
+  if(f)
+    filedup(f);
+  return addr;
+}
+
+// Unmap the pages of [addr, addr+len) from p's regions and
+// free them.  The heap can only shrink with sbrk().
+int
+vmaunmap(struct proc *p, uint addr, uint len)
+{
+  struct file *f[NVMA];
+  uint end;
+  int i, n;
+
+  if((end = rangeend(p, addr, len)) == 0)
+    return -1;
+  if(split(p, addr) < 0 || split(p, end) < 0)
+    return -1;
+  // Write back and free the pages while the files are open.
+  deallocuvm(p->pgdir, end, addr);
+  tlbflush(p->pgdir, addr, (end - addr) / PGSIZE);
+  n = 0;
+  for(i = 0; i < p->nvma; ){
+    if(p->vma[i].start >= addr && p->vma[i].end <= end){
+      if(p->vma[i].f)
+        f[n++] = p->vma[i].f;
+      removevma(p, i);
+    } else
+      i++;
+  }
+  for(i = 0; i < n; i++)
+    fileclose(f[i]);
+  return 0;
+}
+
+// Set the protection of the pages of [addr, addr+len), which
+// must lie in p's regions above the heap, to prot.
+int
+vmaprotect(struct proc *p, uint addr, uint len, int prot)
+{
+  struct vma *v;
+  uint end, a;
+
+  if((end = rangeend(p, addr, len)) == 0)
+    return -1;
+  if((prot & ~(PROT_READ|PROT_WRITE)) != 0)
+    return -1;
+  for(a = addr; a < end; a = v->end){
+    if((v = findvma(p, a)) == 0)
+      return -1;
+    if((prot & PROT_WRITE) && v->f && (v->flags & MAP_SHARED) &&
+       !v->f->writable)
+      return -1;
+  }
+  if(split(p, addr) < 0 || split(p, end) < 0)
+    return -1;
+  for(a = addr; a < end; a = v->end){
+    v = findvma(p, a);
+    v->prot = prot;
+  }
+  if(protectuvm(p->pgdir, addr, end, vmaperm(v)) < 0)
+    return -1;
+  tlbflush(p->pgdir, addr, (end - addr) / PGSIZE);
+  return 0;
+}
+
+// Have faults on missing pages of [addr, addr+len), which must
+// lie in p's anonymous mmap() regions, go to p->uf.
+int
+vmaregister(struct proc *p, uint addr, uint len)
+{
+  struct vma *v;
+  uint end, a;
+
+  if(p->uf == 0 || (end = rangeend(p, addr, len)) == 0)
+    return -1;
+  for(a = addr; a < end; a = v->end)
+    if((v = findvma(p, a)) == 0 || v->f)
+      return -1;
+  if(split(p, addr) < 0 || split(p, end) < 0)
+    return -1;
+  for(a = addr; a < end; a = v->end){
+    v = findvma(p, a);
+    v->flags |= VMA_UF;
+  }
+  return 0;
+}
+
+// Fill in page va of p, in region v, after a fault.  The page
+// is missing or swapped out; or it is a page of the file mapped
+// read-only and write is set, because it is being written.
+// Returns -1 if out of memory.
+int
+vmafault(struct proc *p, struct vma *v, uint va, int write)
+{
+  pte_t *pte;
+  char *pg;
+  uint perm;
+
+  pte = uva2pte(p->pgdir, va);
+  if(v->f == 0){
+    if((v->flags & VMA_UF) && p->uf && !(pte && (*pte & PTE_S)))
+      return ufault(p, va, vmaperm(v), write);
+    return map_address(p->pgdir, va, vmaperm(v));
+  }
+  if(pte && (*pte & PTE_S))
+    return map_address(p->pgdir, va, 0);  // a private copy
+  if(pte && (*pte & PTE_P) && (v->flags & MAP_SHARED)){
+    // PTE_D will tell whether to write the page back.
+    *pte |= PTE_W;
+    tlbflush(p->pgdir, va, 1);
+    return 0;
+  }
+  if((pg = pcget(v->f->ip, v->off + (va - v->start))) == 0)
+    return -1;
+  perm = vmaperm(v);
+  if((v->flags & MAP_PRIVATE) && !write)
+    perm &= ~PTE_W;
+  return map_cached(p->pgdir, va, pg, perm, (v->flags & MAP_PRIVATE) && write);
+}
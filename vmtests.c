@@ -0,0 +1,459 @@
+#include "param.h"
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "mman.h"
+#include "userfault.h"
+#include "kmem.h"
+#include "swap.h"
+
+// vmtests: tests of the virtual memory system, kept out of
+// usertests so that each binary fits in a file (MAXFILE).
+
+char buf[8192];
+int stdout = 1;
+
+// anonymous mmap, munmap from the middle, mprotect, fork
+void
+mmaptest(void)
+{
+  char *p, *q;
+  int i, pid, n;
+
+  printf(stdout, "mmap test\n");
+  n = 8*4096;
+  p = mmap(0, n, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if(p[i] != 0){
+      printf(stdout, "mmap not zeroed\n");
+      exit();
+    }
+    p[i] = i;
+  }
+
+  // a hole in the middle; the rest stays mapped
+  if(munmap(p + 2*4096, 2*4096) < 0){
+    printf(stdout, "munmap failed\n");
+    exit();
+  }
+  if(p[4*4096] != (char)(4*4096) || p[4096] != (char)4096){
+    printf(stdout, "munmap lost data\n");
+    exit();
+  }
+  if(write(1, p + 2*4096, 1) != -1 || write(1, p + 3*4096 + 100, 1) != -1){
+    printf(stdout, "unmapped page passed to a system call\n");
+    exit();
+  }
+  if((pid = fork()) == 0){
+    p[2*4096] = 1;
+    printf(stdout, "write to unmapped page succeeded\n");
+    exit();
+  }
+  wait();
+
+  // read-only: readable by the child, writing kills it
+  if(mprotect(p, 2*4096, PROT_READ) < 0){
+    printf(stdout, "mprotect failed\n");
+    exit();
+  }
+  if((pid = fork()) == 0){
+    if(p[4096] != (char)4096)
+      printf(stdout, "mprotect lost data\n");
+    p[0] = 1;
+    printf(stdout, "write to read-only page succeeded\n");
+    exit();
+  }
+  wait();
+
+  // a fixed mapping fills the hole again, zeroed
+  q = mmap(p + 2*4096, 4096, PROT_READ|PROT_WRITE,
+           MAP_PRIVATE|MAP_ANON|MAP_FIXED, -1, 0);
+  if(q != p + 2*4096 || q[0] != 0){
+    printf(stdout, "mmap fixed failed\n");
+    exit();
+  }
+  if(munmap(p, n) < 0 || munmap(sbrk(0) - 4096, 4096) != -1){
+    printf(stdout, "munmap failed\n");
+    exit();
+  }
+  printf(stdout, "mmap ok\n");
+}
+
+// mapping a file, shared and private
+void
+mmapfiletest(void)
+{
+  char *p, *q;
+  int fd, fd2, i, m, n;
+
+  printf(stdout, "mmap file test\n");
+  n = 2*4096 + 100;
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  for(i = 0; i < n; i += m){
+    m = n - i < 26 ? n - i : 26;
+    write(fd, "abcdefghijklmnopqrstuvwxyz", m);
+  }
+  p = mmap(0, n, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  q = mmap(0, n, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED || q == MAP_FAILED){
+    printf(stdout, "mmap file failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if(p[i] != 'a' + i%26 || q[i] != 'a' + i%26){
+      printf(stdout, "mmap file wrong data\n");
+      exit();
+    }
+  }
+  if(p[n] != 0){
+    printf(stdout, "mmap file not zeroed past the end\n");
+    exit();
+  }
+
+  // private writes stay private; shared ones reach the file
+  q[4096] = 'Q';
+  p[4097] = 'P';
+  if(p[4096] != 'a' + 4096%26 || q[4097] != 'a' + 4097%26){
+    printf(stdout, "mmap private write visible\n");
+    exit();
+  }
+
+  // read() and write() see the shared mapping's pages at once
+  fd2 = open("mmapfile", O_RDWR);
+  if(read(fd2, buf, 4096) != 4096 || read(fd2, buf, 2) != 2 || buf[1] != 'P'){
+    printf(stdout, "mmap write not seen by read\n");
+    exit();
+  }
+  if(write(fd2, "W", 1) != 1 || p[4098] != 'W'){
+    printf(stdout, "write not seen by mmap\n");
+    exit();
+  }
+  close(fd2);
+  if(munmap(p, n) < 0 || munmap(q, n) < 0){
+    printf(stdout, "munmap file failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("mmapfile", O_RDONLY);
+  if(read(fd, buf, 4096) != 4096 || read(fd, buf, 2) != 2 ||
+     buf[0] != 'a' + 4096%26 || buf[1] != 'P'){
+    printf(stdout, "mmap shared write lost\n");
+    exit();
+  }
+
+  // a read-only file cannot be mapped shared and writable
+  if(mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED){
+    printf(stdout, "mmap of read-only file writable\n");
+    exit();
+  }
+  close(fd);
+  unlink("mmapfile");
+  printf(stdout, "mmap file ok\n");
+}
+
+// pages of a registered region filled in by a handler process
+void
+uffdtest(void)
+{
+  struct ufevent ev;
+  char *p;
+  int fd, i, pid;
+
+  printf(stdout, "uffd test\n");
+  fd = uffd();
+  p = mmap(0, 4*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  if(fd < 0 || p == MAP_FAILED || ufregister(p, 4*4096) < 0){
+    printf(stdout, "uffd setup failed\n");
+    exit();
+  }
+  if((pid = fork()) == 0){
+    // a page not faulted on yet cannot be filled in
+    memset(buf, 'D', 4096);
+    if(ufcopy(fd, p + 3*4096, buf, 4096) != -1)
+      printf(stdout, "ufcopy ahead succeeded\n");
+    for(i = 0; i < 4; i++){
+      if(read(fd, &ev, sizeof(ev)) != sizeof(ev)){
+        printf(stdout, "uffd read failed\n");
+        exit();
+      }
+      memset(buf, 'A' + (ev.addr - (uint)p)/4096, 4096);
+      if(ufcopy(fd, (char*)ev.addr, buf, 4096) < 0)
+        printf(stdout, "ufcopy failed\n");
+    }
+    exit();
+  }
+  for(i = 0; i < 4; i++){
+    if(p[i*4096 + 100] != 'A' + i){
+      printf(stdout, "uffd wrong page\n");
+      exit();
+    }
+  }
+  wait();
+
+  // once the descriptor is closed, pages are zero-filled
+  close(fd);
+  if(munmap(p, 4*4096) < 0 ||
+     mmap(p, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON|MAP_FIXED, -1, 0) != p ||
+     ufregister(p, 4096) < 0 || p[0] != 0){
+    printf(stdout, "uffd after close failed\n");
+    exit();
+  }
+  munmap(p, 4096);
+  printf(stdout, "uffd ok\n");
+}
+
+int
+recurse(int n)
+{
+  volatile char frame[1024];
+
+  frame[0] = n;
+  if(n == 0)
+    return 0;
+  return recurse(n - 1) + (frame[0] == (char)n);
+}
+
+// Two processes, likely on two CPUs, changing mappings at
+// once: munmap and mprotect must flush the TLBs without
+// deadlocking, and no stale translation may survive them.
+void
+tlbtest(void)
+{
+  char *p;
+  int i, j, k, pid[2], n;
+
+  printf(1, "tlb test\n");
+  n = 16*4096;
+  for(k = 0; k < 2; k++){
+    if((pid[k] = fork()) < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid[k] > 0)
+      continue;
+    for(i = 0; i < 200; i++){
+      p = mmap(0, n, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+      if(p == MAP_FAILED){
+        printf(1, "tlbtest: mmap failed\n");
+        exit();
+      }
+      for(j = 0; j < n; j += 4096)
+        p[j] = i + j/4096;
+      if(mprotect(p, n, PROT_READ) < 0){
+        printf(1, "tlbtest: mprotect failed\n");
+        exit();
+      }
+      for(j = 0; j < n; j += 4096)
+        if(p[j] != (char)(i + j/4096)){
+          printf(1, "tlbtest: lost data\n");
+          exit();
+        }
+      if(mprotect(p, n, PROT_READ|PROT_WRITE) < 0 ||
+         munmap(p + 4096, n - 2*4096) < 0){
+        printf(1, "tlbtest: mprotect or munmap failed\n");
+        exit();
+      }
+      p[0] = 1;
+      if(munmap(p, n) < 0){
+        printf(1, "tlbtest: munmap failed\n");
+        exit();
+      }
+    }
+    exit();
+  }
+  wait();
+  wait();
+  printf(1, "tlb ok\n");
+}
+
+// does the stack grow on demand, and does running off its
+// end kill the process rather than wreck other memory?
+void
+stacktest(void)
+{
+  int pid;
+
+  printf(stdout, "stack test\n");
+  if(recurse(200) != 200){
+    printf(stdout, "deep recursion failed\n");
+    exit();
+  }
+  if((pid = fork()) == 0){
+    recurse(2000);
+    printf(stdout, "stack overflow not caught\n");
+    exit();
+  }
+  if(wait() != pid){
+    printf(stdout, "stack test wait failed\n");
+    exit();
+  }
+  printf(stdout, "stack test ok\n");
+}
+
+// Free pages left in the buddy allocator.
+uint
+freepages(void)
+{
+  uint nblock[NORDER], free;
+  int i, n;
+
+  n = kbuddystat(nblock, NORDER);
+  free = 0;
+  for(i = 0; i < n; i++)
+    free += nblock[i] << i;
+  return free;
+}
+
+// Use up physical memory, then create files: in-memory
+// inodes come from kernel memory, and running out of it
+// must make open() fail, not panic the kernel.
+void
+inodemem(void)
+{
+  char name[8], *p;
+  int i, fd, pid;
+
+  printf(1, "inodemem test\n");
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; ; i++){
+      if((p = sbrk(4096)) == (char*)-1)
+        break;
+      *p = 1;
+      if(i % 64 == 0 && freepages() == 0)
+        break;
+    }
+    name[0] = 'i';
+    name[1] = 'm';
+    name[3] = '\0';
+    for(i = 0; i < 40; i++){
+      name[2] = '0' + i;
+      if((fd = open(name, O_CREATE|O_RDWR)) >= 0)
+        close(fd);
+    }
+    for(i = 0; i < 40; i++){
+      name[2] = '0' + i;
+      unlink(name);
+    }
+    exit();
+  }
+  wait();
+  printf(1, "inodemem ok\n");
+}
+
+// a large region gets a superpage only once a 4 MB part of
+// it is wholly populated, not on its first page fault
+void
+supertest(void)
+{
+  struct vmstat st0, st;
+  char *p, *q;
+  int i;
+
+  printf(stdout, "super test\n");
+  p = mmap(0, 8*1024*1024, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap failed\n");
+    exit();
+  }
+  q = (char*)(((uint)p + 4*1024*1024 - 1) & ~(4*1024*1024 - 1));
+  vmstat(&st0);
+  q[0] = 1;
+  for(i = 0; i < 1023; i++)
+    q[i*4096 + 1] = i;
+  vmstat(&st);
+  if(st.superalloc != st0.superalloc){
+    printf(stdout, "superpage mapped before the range was populated\n");
+    exit();
+  }
+  q[1023*4096 + 1] = (char)1023;
+  vmstat(&st);
+  for(i = 0; i < 1024; i++)
+    if(q[i*4096 + 1] != (char)i || q[i*4096] != (i == 0)){
+      printf(stdout, "superpage promotion lost data\n");
+      exit();
+    }
+  munmap(p, 8*1024*1024);
+  if(st.superalloc == st0.superalloc && st.superfail == st0.superfail){
+    printf(stdout, "super test skipped: memory short\n");
+    return;
+  }
+  printf(stdout, "super test ok\n");
+}
+
+// The RAM disk, when there is one (RAMSWAP), has the highest
+// priority of the areas found at boot: a page swapped out
+// must land in it while it has room.
+void
+ramswaptest(void)
+{
+  struct swapstat st[NSWAPAREA];
+  char *p;
+  int i, n, ram;
+  uint pgout;
+
+  printf(stdout, "ram swap test\n");
+  n = swapstat(st, NSWAPAREA);
+  for(ram = 0; ram < n && st[ram].type != SWAP_RAM; ram++)
+    ;
+  if(ram == n || st[ram].nused == st[ram].nslot){
+    printf(stdout, "ram swap test skipped: no room on a RAM disk\n");
+    return;
+  }
+  for(i = 0; i < n; i++)
+    if(st[i].type != SWAP_RAM && !st[i].draining && st[i].prio > st[ram].prio){
+      printf(stdout, "ram swap test skipped: a swap file comes first\n");
+      return;
+    }
+  pgout = st[ram].pgout;
+
+  p = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap failed\n");
+    exit();
+  }
+  memset(p, 'R', 4096);
+  if(swap(p) < 0){
+    printf(stdout, "swap failed\n");
+    exit();
+  }
+  swapstat(st, NSWAPAREA);
+  if(st[ram].pgout == pgout){
+    printf(stdout, "page not swapped to the RAM disk\n");
+    exit();
+  }
+  if(p[0] != 'R' || p[4095] != 'R'){
+    printf(stdout, "page swapped to the RAM disk lost\n");
+    exit();
+  }
+  munmap(p, 4096);
+  printf(stdout, "ram swap test ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf(1, "vmtests starting\n");
+
+  mmaptest();
+  mmapfiletest();
+  tlbtest();
+  stacktest();
+  uffdtest();
+  supertest();
+  ramswaptest();
+  inodemem();
+
+  printf(1, "vmtests ok\n");
+  exit();
+}